@@ -1 +1,3 @@
-cl /nologo /W3 /GR- /Zi src/main.c /link opengl32.lib user32.lib gdi32.lib /SUBSYSTEM:WINDOWS
\ No newline at end of file
+cl /nologo /W3 /GR- /Zi src/main.c /link opengl32.lib user32.lib gdi32.lib /SUBSYSTEM:WINDOWS
+cl /nologo /W3 /GR- /Zi /O2 /DSYS_HEADLESS src/main.c /Fe:ld40_headless.exe /link /SUBSYSTEM:CONSOLE
+cl /nologo /W3 /GR- /Zi /O2 src/bench.c /Fe:ld40_bench.exe /link /SUBSYSTEM:CONSOLE
@@ -0,0 +1,4 @@
+#!/bin/sh
+gcc -std=gnu99 -O2 -g -Wall src/main.c -o ld40 -lGL -lX11 -ldl -lpthread -lm
+gcc -std=gnu99 -O2 -g -Wall -DSYS_HEADLESS src/main.c -o ld40_headless -lpthread -lm
+gcc -std=gnu99 -O2 -g -Wall src/bench.c -o ld40_bench -lpthread -lm
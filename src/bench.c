@@ -0,0 +1,476 @@
+// headless benchmarks built on top of the game code
+// usage: ld40_bench [name] [seed], runs every benchmark without a name
+
+#define SYS_HEADLESS
+#define SYS_INIT_PROC bench_init
+#define SYS_LOOP_PROC bench_loop
+#define SYS_QUIT_PROC bench_quit
+#include "main.c"
+
+#include <stdio.h>
+
+typedef void bench_proc(uint64_t seed);
+
+typedef struct Bench {
+    const char *name;
+    bench_proc *proc;
+} Bench;
+
+typedef struct Bench_State {
+    const char *only;
+    uint64_t seed;
+} Bench_State;
+
+static Bench_State bench_state;
+
+//=============================================================================
+//
+//
+//  MAP GENERATION
+//
+//
+//=============================================================================
+#define BENCH_MAPGEN_RUNS 3
+
+static void bench_mapgen(uint64_t seed) {
+    static const int sizes[] = { 1024, 4096 };
+
+    for(int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        int size = sizes[s];
+        double best = 0.0;
+        uint64_t counts[TILE_TYPE_MAX] = { 0 };
+
+        for(int run = 0; run < BENCH_MAPGEN_RUNS; run++) {
+            Map map;
+            map_init(&map, size);
+            double start = sys_time_now();
+            map_generate(&map, seed, 0, 0, map.size - 1, map.size - 1);
+            double elapsed = sys_time_now() - start;
+            if(run == 0 || elapsed < best) {
+                best = elapsed;
+            }
+            if(run == 0) {
+                for(int c = 0; c < map.chunk_count * map.chunk_count; c++) {
+                    for(int i = 0; i < MAP_CHUNK_SIZE; i++) {
+                        for(int j = 0; j < MAP_CHUNK_SIZE; j++) {
+                            counts[map.chunk[c]->tile[i][j].type]++;
+                        }
+                    }
+                }
+            }
+            map_free(&map);
+        }
+
+        double tiles = (double)size * size;
+        printf("mapgen %5d x %-5d %9.2f ms %9.2f Mtiles/s  water %4.1f%% rock %4.1f%% trees %4.1f%%\n",
+               size, size, best * 1000.0, tiles / best / 1e6,
+               100.0 * counts[TILE_TYPE_WATER] / tiles,
+               100.0 * counts[TILE_TYPE_ROCK] / tiles,
+               100.0 * (counts[TILE_TYPE_TREE] + counts[TILE_TYPE_TREE_RED] + counts[TILE_TYPE_TREE_ORANGE]) / tiles);
+    }
+}
+
+//=============================================================================
+//
+//
+//  PATHFINDING
+//
+//
+//=============================================================================
+#define BENCH_PATH_MAP_SIZE 1024
+#define BENCH_PATH_QUERIES 200
+
+static void bench_random_walkable(Map *map, Sys_Rand *rand, int cx, int cy, int radius, int *x, int *y) {
+    do {
+        if(radius) {
+            *x = cx - radius + (int)sys_rand_range(rand, (uint32_t)(2 * radius + 1));
+            *y = cy - radius + (int)sys_rand_range(rand, (uint32_t)(2 * radius + 1));
+        } else {
+            *x = (int)sys_rand_range(rand, (uint32_t)map->size);
+            *y = (int)sys_rand_range(rand, (uint32_t)map->size);
+        }
+    } while(!map_walkable(map, *x, *y, 0));
+}
+
+static void bench_path(uint64_t seed) {
+    static const int radii[] = { 16, 64, 0 }; // 0 is anywhere on the map
+
+    Map map;
+    map_init(&map, BENCH_PATH_MAP_SIZE);
+    map_generate(&map, seed, 0, 0, map.size - 1, map.size - 1);
+    Path_Finder finder;
+    path_finder_init(&finder);
+
+    // the regions are labelled once up front, queries only read them
+    double start = sys_time_now();
+    path_regions_update(&finder, &map, 0);
+    printf("path   regions    %9.2f ms to label the map\n", (sys_time_now() - start) * 1000.0);
+
+    for(int r = 0; r < (int)(sizeof(radii) / sizeof(radii[0])); r++) {
+        Sys_Rand rand;
+        sys_rand_seed(&rand, seed, (uint64_t)r);
+        int reached = 0;
+        uint64_t waypoints = 0;
+        uint64_t expanded = finder.expanded;
+        double elapsed = 0.0;
+
+        for(int q = 0; q < BENCH_PATH_QUERIES; q++) {
+            int sx, sy, gx, gy;
+            bench_random_walkable(&map, &rand, 0, 0, 0, &sx, &sy);
+            bench_random_walkable(&map, &rand, sx, sy, radii[r], &gx, &gy);
+
+            double start = sys_time_now();
+            uint32_t count = path_find(&finder, &map, sx, sy, gx, gy, 0);
+            elapsed += sys_time_now() - start;
+
+            waypoints += count;
+            if(count && finder.result[count - 1].x == gx && finder.result[count - 1].y == gy) {
+                reached++;
+            }
+        }
+
+        char label[32];
+        if(radii[r]) {
+            snprintf(label, sizeof(label), "within %d", radii[r]);
+        } else {
+            snprintf(label, sizeof(label), "anywhere");
+        }
+        printf("path   %-10s %9.2f us/query %9.0f nodes/query %6.1f waypoints  reached %5.1f%%\n",
+               label, elapsed * 1e6 / BENCH_PATH_QUERIES,
+               (double)(finder.expanded - expanded) / BENCH_PATH_QUERIES,
+               (double)waypoints / BENCH_PATH_QUERIES,
+               100.0 * reached / BENCH_PATH_QUERIES);
+    }
+
+    path_finder_free(&finder);
+    map_free(&map);
+}
+
+// long orders through the cluster graph. an order is the graph search and
+// its first leg, the later legs are refined one by one as units walk them.
+// the first pass builds the clusters it touches, the second one runs on a
+// warm graph
+#define BENCH_GRAPH_QUERIES 500
+
+static void bench_graph(uint64_t seed) {
+    Map map;
+    map_init(&map, BENCH_PATH_MAP_SIZE);
+    map_generate(&map, seed, 0, 0, map.size - 1, map.size - 1);
+    Path_Finder finder;
+    path_finder_init(&finder);
+    Path_Graph graph;
+    path_graph_init(&graph, &map);
+    // a graph path visits every node at most once
+    Sys_Memory nodes_memory = sys_alloc(sizeof(Path_Point) * (size_t)map.chunk_count * (size_t)map.chunk_count * PATH_CLUSTER_NODES, 0);
+    Path_Point *nodes = (Path_Point *)nodes_memory.ptr;
+
+    for(int pass = 0; pass < 2; pass++) {
+        Sys_Rand rand;
+        sys_rand_seed(&rand, seed, 0);
+        double found_time = 0.0;
+        double missed_time = 0.0;
+        double leg_time = 0.0;
+        int found = 0;
+        int legs = 0;
+        uint64_t expanded = graph.search.expanded;
+
+        for(int q = 0; q < BENCH_GRAPH_QUERIES; q++) {
+            int sx, sy, gx, gy;
+            bench_random_walkable(&map, &rand, 0, 0, 0, &sx, &sy);
+            do {
+                bench_random_walkable(&map, &rand, 0, 0, 0, &gx, &gy);
+            } while(path_heuristic(sx, sy, gx, gy) <= PATH_GRAPH_MIN_DISTANCE);
+
+            double start = sys_time_now();
+            int count = path_find_hierarchical(&graph, &finder, &map, sx, sy, gx, gy);
+            if(count <= 0) {
+                missed_time += sys_time_now() - start;
+                continue;
+            }
+            memcpy(nodes, graph.result, sizeof(Path_Point) * (size_t)count);
+            Path_Point from;
+            from.x = (uint16_t)sx;
+            from.y = (uint16_t)sy;
+            graph.result_count = 0;
+            uint32_t used = path_graph_refine_leg(&graph, &finder, &map, from, nodes, (uint32_t)count);
+            found_time += sys_time_now() - start;
+            found++;
+
+            // a unit stands on the last node of the leg it walked
+            start = sys_time_now();
+            while(used < (uint32_t)count) {
+                graph.result_count = 0;
+                used += path_graph_refine_leg(&graph, &finder, &map, nodes[used - 1], nodes + used, (uint32_t)count - used);
+                legs++;
+            }
+            leg_time += sys_time_now() - start;
+        }
+
+        int missed = BENCH_GRAPH_QUERIES - found;
+        printf("graph  %-5s %9.2f us/order (%d) %9.2f us/unreachable (%d) %7.2f us/later leg (%.1f/order) %7.0f graph nodes/query  %" PRIu64 " clusters built\n",
+               pass ? "warm" : "cold",
+               found ? found_time * 1e6 / found : 0.0, found,
+               missed ? missed_time * 1e6 / missed : 0.0, missed,
+               legs ? leg_time * 1e6 / legs : 0.0, found ? (double)legs / found : 0.0,
+               (double)(graph.search.expanded - expanded) / BENCH_GRAPH_QUERIES, graph.clusters_built);
+    }
+
+    sys_free(nodes_memory);
+    path_graph_free(&graph);
+    path_finder_free(&finder);
+    map_free(&map);
+}
+
+// one group order: a path per unit against a single flow field
+#define BENCH_GROUP_UNITS 256
+#define BENCH_GROUP_ORDERS 4
+
+static void bench_group(uint64_t seed) {
+    Map map;
+    map_init(&map, BENCH_PATH_MAP_SIZE);
+    map_generate(&map, seed, 0, 0, map.size - 1, map.size - 1);
+    Path_Finder finder;
+    path_finder_init(&finder);
+    Flow_Field_Set flow_fields = { 0 };
+    Army army;
+    army_init(&army, BENCH_GROUP_UNITS);
+
+    Sys_Rand rand;
+    sys_rand_seed(&rand, seed, 0);
+    double path_time = 0.0;
+    double flow_time = 0.0;
+    int starts[BENCH_GROUP_UNITS][2];
+
+    for(int order = 0; order < BENCH_GROUP_ORDERS; order++) {
+        int cx, cy, gx, gy;
+        bench_random_walkable(&map, &rand, 0, 0, 0, &cx, &cy);
+        bench_random_walkable(&map, &rand, cx, cy, 64, &gx, &gy);
+        int left = map.size, top = map.size, right = -1, bottom = -1;
+        for(int u = 0; u < BENCH_GROUP_UNITS; u++) {
+            bench_random_walkable(&map, &rand, cx, cy, 16, &starts[u][0], &starts[u][1]);
+            left = starts[u][0] < left ? starts[u][0] : left;
+            top = starts[u][1] < top ? starts[u][1] : top;
+            right = starts[u][0] > right ? starts[u][0] : right;
+            bottom = starts[u][1] > bottom ? starts[u][1] : bottom;
+        }
+
+        double start = sys_time_now();
+        for(int u = 0; u < BENCH_GROUP_UNITS; u++) {
+            path_find(&finder, &map, starts[u][0], starts[u][1], gx, gy, 0);
+        }
+        path_time += sys_time_now() - start;
+
+        start = sys_time_now();
+        flow_field_build(&flow_fields, &map, &army, gx, gy, left, top, right, bottom);
+        flow_time += sys_time_now() - start;
+    }
+
+    printf("group  %d units  %9.2f ms/order with a path each  %9.2f ms/order with a flow field\n",
+           BENCH_GROUP_UNITS, path_time * 1000.0 / BENCH_GROUP_ORDERS, flow_time * 1000.0 / BENCH_GROUP_ORDERS);
+
+    army_free(&army);
+    flow_fields_free(&flow_fields);
+    path_finder_free(&finder);
+    map_free(&map);
+}
+
+// whole games at a fixed army size, driven through update() by scripted
+// keys so the orders take the same path a player's input does. each system
+// is timed by its profiler block
+#define BENCH_ARMY_TICKS 600
+#define BENCH_ARMY_WIDTH 1024
+#define BENCH_ARMY_HEIGHT 768
+#define BENCH_ARMY_SPAWN_TICK 400
+
+typedef struct Bench_Key {
+    int tick;
+    unsigned char key; // down for that one tick
+    int mouse_x, mouse_y;
+} Bench_Key;
+
+// select all and move to the top left of the view, drag a box over the
+// whole view and disperse what it caught, then harvest and spawn. the left
+// button goes down at one corner and comes up a tick later with the mouse
+// moved to the other by the 'D' entry
+static const Bench_Key bench_army_script[] = {
+    { 1, SYS_KEY_F2, 0, 0 },
+    { 2, SYS_MOUSE_RIGHT, 0, 0 },
+    { 199, SYS_MOUSE_LEFT, 0, 0 },
+    { 200, 'D', BENCH_ARMY_WIDTH - 1, BENCH_ARMY_HEIGHT - 1 },
+    { 300, SYS_KEY_F2, 0, 0 },
+    { 300, 'E', 0, 0 },
+    { BENCH_ARMY_SPAWN_TICK, 'Q', 0, 0 },
+};
+
+static const char *bench_army_systems[] = {
+    "input", "allies", "enemies", "horde field", "combat", "spawn",
+};
+
+#define BENCH_ARMY_SYSTEMS (int)(sizeof(bench_army_systems) / sizeof(bench_army_systems[0]))
+
+static void bench_army_run(uint64_t seed, int units) {
+    sys_memory_reset_peak();
+    Sys_Memory memory = sys_alloc(sizeof(Game_State), 0);
+    Game_State *state = (Game_State *)memory.ptr;
+    state->map_seed = seed;
+    sys_rand_seed(&state->rand, seed, 1);
+    state->horde_field = -1;
+    map_init(&state->map, MAP_GRID_SIZE);
+    map_generate(&state->map, seed, 0, 0, MAP_GRID_SIZE - 1, MAP_GRID_SIZE - 1);
+    path_finder_init(&state->path_finder);
+    path_graph_init(&state->path_graph, &state->map);
+    army_init(&state->ally, units);
+    army_init(&state->enemy, units * ENEMY_PER_ALLY);
+
+    // NOTE: a square about twice the army in tiles, units stack where the
+    // map is crowded with trees and water
+    int half = 1;
+    while(4 * half * half < 2 * units) {
+        half++;
+    }
+    state->camera.x = (float)(MAP_GRID_SIZE / 2 - GRID_SIZE / 2);
+    state->camera.y = (float)(MAP_GRID_SIZE / 2 - GRID_SIZE / 2);
+    int cx = MAP_GRID_SIZE / 2;
+    int cy = MAP_GRID_SIZE / 2;
+    for(int u = 0; u < units; u++) {
+        int x, y;
+        bench_random_walkable(&state->map, &state->rand, cx, cy, half, &x, &y);
+        Unit_Handle h = army_spawn(&state->ally, UNIT_TYPE_MALE + (u & 1), (float)(x - 1), (float)(y - 1));
+        state->ally.resource[army_index(&state->ally, h)] = START_RESOURCE;
+    }
+    // the horde the waves keep topping up, brought in up front so the enemy
+    // rows run at the scenario's size from the first tick
+    while(state->enemy.count < units * ENEMY_PER_ALLY) {
+        int before = state->enemy.count;
+        enemy_spawn_wave(state);
+        if(state->enemy.count == before) {
+            break;
+        }
+    }
+
+    Sys_State *sys = &__sys_state;
+    sys->width = BENCH_ARMY_WIDTH;
+    sys->height = BENCH_ARMY_HEIGHT;
+    sys->mouse.x = 0;
+    sys->mouse.y = 0;
+    sys->dt = SIM_DT;
+
+    uint64_t ticks[BENCH_ARMY_SYSTEMS] = { 0 };
+    uint64_t unit_ticks[BENCH_ARMY_SYSTEMS] = { 0 };
+    uint64_t total_ticks = 0;
+    uint64_t total_units = 0;
+    for(int tick = 0; tick < BENCH_ARMY_TICKS; tick++) {
+        // NOTE: all up first, a key in the script more than once is down
+        // when any of its entries is on this tick
+        for(int k = 0; k < (int)(sizeof(bench_army_script) / sizeof(bench_army_script[0])); k++) {
+            sys_key_set(bench_army_script[k].key, 0);
+        }
+        for(int k = 0; k < (int)(sizeof(bench_army_script) / sizeof(bench_army_script[0])); k++) {
+            const Bench_Key *key = &bench_army_script[k];
+            if(key->tick == tick) {
+                sys_key_set(key->key, 1);
+                sys->mouse.x = key->mouse_x;
+                sys->mouse.y = key->mouse_y;
+            }
+        }
+        if(tick == BENCH_ARMY_SPAWN_TICK) {
+            // NOTE: resources drain a point per step, hand out a unit's worth
+            for(int i = 0; i < state->ally.count; i++) {
+                state->ally.resource[i] = UNIT_COST;
+            }
+        }
+        int alive = state->ally.count + state->enemy.count;
+
+        profile_frame_begin();
+        profile_begin("update");
+        update(state, sys);
+        profile_end();
+        profile_frame_end();
+        sys_input_advance();
+
+        // NOTE: systems without a unit count are spread over the whole game
+        Profile_Frame *frame = profile_frame(profiler.frame_count - 1);
+        total_ticks += frame->block[0].end - frame->block[0].start;
+        total_units += (uint64_t)alive;
+        for(int b = 1; b < frame->count; b++) {
+            Profile_Block *block = &frame->block[b];
+            for(int s = 0; s < BENCH_ARMY_SYSTEMS; s++) {
+                if(strcmp(block->name, bench_army_systems[s]) == 0) {
+                    ticks[s] += block->end - block->start;
+                    unit_ticks[s] += block->units ? (uint64_t)block->units : (uint64_t)alive;
+                }
+            }
+        }
+    }
+
+    printf("army   %5d units  %8.3f ms/tick %7.1f ns/unit/tick  peak %7.1f MB  %d allies %d enemies left\n",
+           units, profile_ms(total_ticks) / BENCH_ARMY_TICKS,
+           profile_ms(total_ticks) * 1e6 / (double)total_units,
+           (double)sys_memory_peak() / (1024.0 * 1024.0), state->ally.count, state->enemy.count);
+    for(int s = 0; s < BENCH_ARMY_SYSTEMS; s++) {
+        printf("       %-12s %8.3f ms/tick %7.1f ns/unit/tick\n", bench_army_systems[s],
+               profile_ms(ticks[s]) / BENCH_ARMY_TICKS,
+               unit_ticks[s] ? profile_ms(ticks[s]) * 1e6 / (double)unit_ticks[s] : 0.0);
+    }
+
+    for(int k = 0; k < (int)(sizeof(bench_army_script) / sizeof(bench_army_script[0])); k++) {
+        sys_key_set(bench_army_script[k].key, 0);
+    }
+    sys_input_advance();
+    map_free(&state->map);
+    path_finder_free(&state->path_finder);
+    path_graph_free(&state->path_graph);
+    flow_fields_free(&state->flow_fields);
+    flow_fields_free(&state->horde_fields);
+    army_free(&state->ally);
+    army_free(&state->enemy);
+    if(state->selection_memory.ptr) {
+        sys_free(state->selection_memory);
+    }
+    sys_free(memory);
+}
+
+static void bench_army(uint64_t seed) {
+    static const int sizes[] = { 256, 4096, 65536 };
+    for(int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++) {
+        bench_army_run(seed, sizes[s]);
+    }
+}
+
+static const Bench benches[] = {
+    { "mapgen", bench_mapgen },
+    { "path", bench_path },
+    { "graph", bench_graph },
+    { "group", bench_group },
+    { "army", bench_army },
+};
+
+Sys_Config bench_init(int argc, char **argv) {
+    Sys_Config cfg = { 0 };
+    bench_state.seed = 1;
+    if(argc > 0) {
+        bench_state.only = argv[0];
+    }
+    if(argc > 1) {
+        bench_state.seed = strtoull(argv[1], NULL, 10);
+    }
+
+    sys_job_init(0);
+    printf("%d threads, seed %" PRIu64 "\n", sys_job_thread_count(), bench_state.seed);
+    return cfg;
+}
+
+void bench_loop(Sys_State *sys) {
+    sys_unused(sys);
+    for(int i = 0; i < (int)(sizeof(benches) / sizeof(benches[0])); i++) {
+        if(!bench_state.only || strcmp(bench_state.only, benches[i].name) == 0) {
+            benches[i].proc(bench_state.seed);
+        }
+    }
+    sys_quit();
+}
+
+void bench_quit(Sys_State *sys) {
+    sys_unused(sys);
+    sys_job_shutdown();
+}
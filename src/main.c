@@ -1,6 +1,9 @@
+// NOTE: bench.c includes this file with its own procs
+#ifndef SYS_INIT_PROC
 #define SYS_INIT_PROC init
 #define SYS_LOOP_PROC loop
 #define SYS_QUIT_PROC quit
+#endif
 #define SYS_OPENGL
 #define SYS_OPENGL_MAJOR 1
 #define SYS_OPENGL_MINOR 2
@@ -10,22 +13,48 @@
 #define LINEAR_ALGEBRA_IMPLEMENTATION
 #include "linear_algebra.h"
 
+#ifndef SYS_HEADLESS
+// NOTE: only the string drawing uses it, keep -Wall quiet about the header
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-braces"
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
 #include "stb_easy_font.h"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+#endif /* SYS_HEADLESS */
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include <float.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
+#if !defined(GAME_NO_SIMD) && defined(__AVX2__)
+#define GAME_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(GAME_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define GAME_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
 #define SPRITE_SHEET_NAME "sprites.png"
-#define MAP_GRID_SIZE 1024
-#define MAX_ARMY_SIZE 256
+#ifndef MAP_GRID_SIZE
+#define MAP_GRID_SIZE 1024 // tiles per side, a multiple of GRID_SIZE
+#endif
 #define GRID_SIZE 32
 #define LOG_FILE "log.txt"
+#define TRACE_FILE "trace.json" // written by builds with GAME_TRACE defined
+#define REPLAY_FILE "replay.bin"
+#define SNAPSHOT_FILE "snapshot.bin" // F5 saves, F9 loads
 #define SPRITE_SIZE 8
 
 #define UNIT_TILES_PER_SECOND 10.0f
+#define UNIT_SLOW_TILES_PER_SECOND 3.0f // under a quarter of START_HP
 #define UNIT_ANIMATION_FRAMES 8
 #define UNIT_ANIMATION_FRAME_TIME 0.1f
 
@@ -37,6 +66,31 @@
 // NOTE(rayalan): 1.0 maybe for a get the highest score you can type of game
 #define RESOURCE_DRAIN_TIME 0.0f
 
+// the horde grows with the army, waves spawn out of sight around a random ally
+#define ENEMY_PER_ALLY 2
+#define ENEMY_SPAWN_TIME 2.0f
+#define ENEMY_SPAWN_WAVE 64 // fewest enemies one wave brings
+#define ENEMY_SPAWN_SHARE 4 // a wave brings at least 1/4 of the missing enemies
+#define ENEMY_SPAWN_DISTANCE 24.0f
+#define ENEMY_SIGHT 16.0f // tiles an enemy spots allies from
+#define ENEMY_TARGET_TIME 0.25f // seconds between nearest ally queries
+#define ENEMY_ATTACK_RANGE 1.5f // diagonal neighbours are in reach
+#define ENEMY_ATTACK_TIME 1.0f
+#define ENEMY_DAMAGE 1
+#define ENEMY_FIELD_TIME 0.5f // seconds between horde field rebuilds
+
+#define ALLY_ATTACK_RANGE 1.5f
+#define ALLY_ATTACK_TIME 0.8f
+#define ALLY_DAMAGE 1
+#define BLEED_TIME 2.0f // seconds per hp a unit under half of START_HP loses
+
+// the simulation always steps at SIM_DT, rendering interpolates between the
+// last two steps. at most SIM_MAX_STEPS run per frame, the rest is dropped
+#define SIM_HZ 60
+#define SIM_DT (1.0f / SIM_HZ)
+#define SIM_MAX_STEPS 4
+
+#ifndef SYS_HEADLESS
 //=============================================================================
 //
 //
@@ -79,6 +133,7 @@ void right_string(float x, float y, float size, char *text) {
     draw_string(x/size - shift, y/size, text);
     glPopMatrix();
 }
+#endif /* SYS_HEADLESS */
 
 
 
@@ -93,6 +148,8 @@ void right_string(float x, float y, float size, char *text) {
 typedef enum Cooldown {
     COOLDOWN_ATTACK,
     COOLDOWN_HARVEST,
+    COOLDOWN_TARGET,
+    COOLDOWN_BLEED,
     COOLDOWN_MAX
 } Cooldown;
 
@@ -119,49 +176,3794 @@ typedef enum Unit_Type {
 
 #define UNIT_FLAG_MOVING    0x00000001
 #define UNIT_FLAG_SWIMMING  0x00000002
+#define UNIT_FLAG_PATH      0x00000004 // following the waypoints in the army's path pool
+#define UNIT_FLAG_FLOW      0x00000008 // following a flow field toward a group order's target
+#define UNIT_FLAG_BLEEDING  0x00000010 // under half of START_HP, loses hp over time
+#define UNIT_FLAG_SLOW      0x00000020 // under a quarter of START_HP
+
+// handles stay valid while a unit is alive, despawning bumps the slot's
+// generation so stale handles stop resolving
+typedef struct Unit_Handle {
+    uint32_t index;
+    uint32_t generation;
+} Unit_Handle;
+
+#define ARMY_NO_SLOT 0xFFFFFFFF
+#define ARMY_START_CAPACITY 256
+#define ARMY_UPDATE_BATCH 64
+
+// units are bucketed into a uniform grid of UNIT_CELL_SIZE tiles so rectangle
+// queries only walk the cells they overlap
+#define UNIT_CELL_SIZE 8
+#define UNIT_CELLS_PER_ROW (MAP_GRID_SIZE / UNIT_CELL_SIZE)
+
+// NOTE: units are stored as columns so every pass only streams the fields it
+// touches. movement and selection read the hot columns each frame, the cold
+// ones are only read by drain, drawing and the hp/resource totals.
+// columns are packed, [0, count) are always live units. despawn moves the
+// last unit into the hole so handles go through the slot table.
+#define ARMY_COLUMNS(COLUMN) \
+    /* hot */ \
+    COLUMN(float, x) \
+    COLUMN(float, y) \
+    COLUMN(float, look_x) \
+    COLUMN(float, look_y) \
+    COLUMN(int, flags) /* is_moving / etc */ \
+    COLUMN(float, prev_x) /* position before the last step, for drawing */ \
+    COLUMN(float, prev_y) \
+    COLUMN(float, speed) /* tiles per second */ \
+    /* cold */ \
+    COLUMN(int, type) \
+    COLUMN(int, hp) \
+    COLUMN(int, resource) \
+    COLUMN(int, animation_frame) \
+    COLUMN(float, animation_time) \
+    COLUMN(uint32_t, cell) /* grid cell the unit is linked into */ \
+    COLUMN(uint32_t, slot) /* back to the slot table */ \
+    COLUMN(uint32_t, path_start) /* first waypoint in the path pool */ \
+    COLUMN(uint32_t, path_count) \
+    COLUMN(uint32_t, path_next) /* waypoint being walked to, path_count when done */ \
+    COLUMN(uint32_t, path_refined) /* waypoints from here on are cluster graph nodes, see army_path_refine */ \
+    COLUMN(uint32_t, flow) /* flow field followed with UNIT_FLAG_FLOW */ \
+    COLUMN(Unit_Handle, target) /* unit of the other army being chased */ \
+    COLUMN(int, damage) /* taken this step, applied by the resolve pass */
+
+// a hit queued by the update jobs, the other army takes it in the resolve pass
+typedef struct Attack_Event {
+    Unit_Handle target;
+    int damage;
+} Attack_Event;
+
+// a tile on a path, the corners of the path are all that gets stored
+typedef struct Path_Point {
+    uint16_t x, y;
+} Path_Point;
+
+typedef struct Army {
+    int count;
+    int capacity;
+    Sys_Memory memory;
+#define ARMY_DECLARE_COLUMN(T, name) T *name;
+    ARMY_COLUMNS(ARMY_DECLARE_COLUMN)
+#undef ARMY_DECLARE_COLUMN
+    float *cooldown[COOLDOWN_MAX];
+    // slot table, indexed by Unit_Handle.index
+    uint32_t *slot_dense; // column index of a live slot, next free slot otherwise
+    uint32_t *slot_generation;
+    uint32_t *slot_next; // grid cell list
+    uint32_t *slot_prev;
+    uint32_t slot_count;
+    uint32_t free_slot;
+    // spatial grid, head slot of every cell's list
+    Sys_Memory grid_memory;
+    uint32_t *cell_head;
+    // scratch for the update jobs, units that changed cell or ran out of
+    // refined waypoints, hits and deaths per batch. a batch writes from its
+    // first unit's index on
+    int *moved;
+    int *moved_count;
+    int *stalled;
+    int *stalled_count;
+    Attack_Event *events;
+    int *event_count;
+    int *dead;
+    int *dead_count;
+    // waypoints of every unit's path back to back. the update jobs only read
+    // it, orders append and compact it between steps
+    Sys_Memory path_memory;
+    Path_Point *path_points;
+    uint32_t path_used;
+    uint32_t path_capacity;
+} Army;
 
-typedef struct Unit { 
-    float x, y, look_x, look_y;
-    int type;
-    int hp;
-    int resource;
-    int flags; // is_moving / etc
-    int animation_frame;
-    float animation_time;
-    float cooldown[COOLDOWN_MAX];
-} Unit;
-
-// 2 bytes * 1024 * 1024 = 2 MB 
 typedef struct Tile {
     unsigned char type;
     unsigned char resource;
 } Tile;
 
+// the map is split into chunks of MAP_CHUNK_SIZE^2 tiles that are only
+// allocated once something is written to them, untouched chunks read as grass
+#define MAP_CHUNK_SIZE GRID_SIZE
+#define MAP_CHUNKS_PER_BLOCK 64 // chunks are carved from blocks of this many
+#define MAP_START_MARGIN 64 // tiles generated up front around the first screen, past where enemies spawn
+
+typedef struct Map_Chunk {
+    Tile tile[MAP_CHUNK_SIZE][MAP_CHUNK_SIZE]; // [x][y] like the rest of the map
+    uint32_t version; // bumped when a tile changes type
+} Map_Chunk;
+
+typedef struct Map_Block {
+    Sys_Memory memory;
+    struct Map_Block *next;
+} Map_Block;
+
+typedef struct Map {
+    int size; // tiles per side
+    int chunk_count; // chunks per side
+    Sys_Memory table_memory;
+    Map_Chunk **chunk; // [chunk_y * chunk_count + chunk_x], 0 until written
+    Map_Block *blocks;
+    Map_Chunk *block_next; // next unused chunk in the newest block
+    int block_free;
+    int chunks_allocated;
+    uint32_t version; // bumped with every chunk's
+    Sys_File_View view; // chunks used in place from a snapshot
+    uint64_t seed;
+    int generated; // chunks not carved yet hold the seed's terrain instead of map_default_tile
+} Map;
+
+#define PATH_NO_NODE 0xFFFFFFFF
+#define PATH_MAX_NODES (1 << 18) // searches give up and take the closest node after this many
+#define PATH_START_CAPACITY 4096
+#define PATH_SWIM 0x1 // water is walkable
+#define PATH_NO_REGION 0xFFFF
+#define PATH_SNAP_RADIUS 32 // how far a goal moves to land in the start's region
+
+typedef struct Path_Node {
+    uint32_t tile; // y * map size + x
+    uint32_t parent;
+    float g;
+    float f;
+    uint32_t heap_index; // PATH_NO_NODE once closed
+} Path_Node;
+
+typedef struct Path_Table_Entry {
+    uint32_t search; // the entry is empty unless this is the current search
+    uint32_t node;
+} Path_Table_Entry;
+
+// connected parts of the map, a search only runs toward a goal it can reach.
+// tiles are labelled per chunk and the labels of neighbouring chunks joined
+// into map wide regions, a change relabels just the chunks it touched.
+// chunks that aren't carved yet aren't labelled, together they are one
+// frontier region that reaches every walkable tile on its border. that
+// answer errs on the reachable side until searches carve the chunks around
+typedef struct Path_Regions {
+    int built;
+    int flags;
+    uint32_t map_version; // map->version the regions are current with
+    int chunks_labelled; // map->chunks_allocated they are current with
+    Sys_Memory memory;
+    uint16_t *label; // [chunk][y * MAP_CHUNK_SIZE + x] within the chunk, PATH_NO_REGION when blocked
+    uint16_t *label_count; // per chunk
+    uint32_t *chunk_version; // version + 1 the chunk was labelled at, 0 in the frontier
+    uint32_t *first; // id of the chunk's label 0, ids are dense over the map
+    uint32_t frontier; // id of the frontier, after every label's
+    Sys_Memory region_memory;
+    uint32_t *region; // id -> region, the smallest id in it
+    uint32_t region_capacity;
+} Path_Regions;
+
+// NOTE: everything a search touches lives in one arena that only grows, the
+// tile -> node table is stamped with the search id so it is never cleared
+typedef struct Path_Finder {
+    Sys_Memory memory;
+    uint32_t capacity; // nodes, the table has twice as many entries
+    Path_Node *nodes;
+    uint32_t node_count;
+    uint32_t *heap;
+    uint32_t heap_count;
+    Path_Table_Entry *table;
+    uint32_t search;
+    // the last path found, corners only, start excluded
+    Sys_Memory result_memory;
+    Path_Point *result;
+    uint32_t result_count;
+    uint32_t result_capacity;
+    uint64_t expanded; // nodes closed over every search, for the benchmark
+    Path_Regions regions[2]; // walking and swimming, built by the first search that needs them
+} Path_Finder;
+
+// NOTE: the most a border can hold is a run on every other tile, one
+// transition each, so every walkable way across is in the graph
+#define PATH_CLUSTER_NODES (4 * MAP_CHUNK_SIZE / 2)
+#define PATH_WIDE_ENTRANCE 8 // longer runs get a transition at both ends
+#define PATH_COST_SCALE 32.0f
+#define PATH_NO_EDGE 0xFFFF
+#define PATH_CLUSTERS_PER_BLOCK 64
+#define PATH_GRAPH_GOAL 0xFFFFFFFE
+#define PATH_GRAPH_MIN_DISTANCE (2.0f * MAP_CHUNK_SIZE) // shorter orders use plain A*
+
+typedef struct Path_Cluster {
+    int built;
+    uint32_t versions[5]; // chunk versions of the cluster and its 4 neighbours when built
+    int node_count;
+    Path_Point node[PATH_CLUSTER_NODES]; // transition tiles inside the cluster
+    uint16_t dist[PATH_CLUSTER_NODES][PATH_CLUSTER_NODES]; // in 1/PATH_COST_SCALE tiles
+    uint8_t walkable[MAP_CHUNK_SIZE * MAP_CHUNK_SIZE]; // [y][x], local searches never touch the map
+} Path_Cluster;
+
+typedef struct Path_Graph {
+    int cluster_count; // per side, one per map chunk
+    Sys_Memory table_memory;
+    Path_Cluster **cluster; // 0 until a search touches it
+    Map_Block *blocks;
+    Path_Cluster *block_next;
+    int block_free;
+    Path_Finder search; // keyed by graph node instead of tile
+    Sys_Memory result_memory;
+    Path_Point *result;
+    uint32_t result_count;
+    uint32_t result_capacity;
+    uint64_t clusters_built;
+} Path_Graph;
+
+#define FLOW_FIELD_MAX 16
+#define FLOW_FIELD_MARGIN 32 // tiles around the units and target a field covers
+#define FLOW_FIELD_MIN_UNITS 8 // smaller groups path one unit at a time
+#define FLOW_NONE 0xFF // at the target or cut off from it
+#define FLOW_WANTED 0x2 // marks the walkable cells a chase field has to reach
+#define FLOW_CHASE_SLACK 8.0f // tiles a chase field reaches past its farthest chaser
+#define FLOW_BUCKETS 3 // a step is at most 2 cost buckets on, see flow_field_integrate
+
+// one integration pass from a target gives every tile in the region the
+// direction of its next step, any number of units sample it per step
+typedef struct Flow_Field {
+    int x0, y0; // region in tiles
+    int width, height;
+    int goal_x, goal_y; // -1 for chase fields, they lead to the closest of many
+    uint64_t built; // order the fields were built in, the oldest is evicted
+    Sys_Memory memory;
+    int capacity; // cells
+    uint8_t *dir; // index into flow_dirs
+} Flow_Field;
+
+typedef struct Flow_Field_Set {
+    Flow_Field field[FLOW_FIELD_MAX];
+    uint64_t builds;
+    // integration scratch shared by every build
+    Sys_Memory scratch_memory;
+    int scratch_capacity;
+    float *cost;
+    uint32_t *bucket[FLOW_BUCKETS]; // cells by whole cost, reused round robin
+    uint32_t bucket_count[FLOW_BUCKETS];
+    uint32_t *queued; // bucket the cell is waiting in, PATH_NO_NODE when none
+    uint8_t *walkable; // | FLOW_WANTED
+} Flow_Field_Set;
+
 typedef struct Sprite_Sheet {
     unsigned int id;
     int width, height;
 } Sprite_Sheet;
 
+// the map is drawn a chunk at a time, every chunk's mesh is cached until one
+// of its tiles changes type
+#define TILE_CHUNK_SIZE MAP_CHUNK_SIZE
+#define TILE_CHUNK_VERTICES (TILE_CHUNK_SIZE * TILE_CHUNK_SIZE * 4)
+#define TILE_CACHE_SIZE 4 // the screen overlaps at most 2x2 chunks
+
+typedef struct Draw_Vertex {
+    float x, y, u, v;
+} Draw_Vertex;
+
+typedef struct Tile_Chunk_Mesh {
+    int chunk_x, chunk_y; // -1 when empty
+    uint32_t version; // chunk_version this was built from
+    unsigned int buffer; // vbo, 0 without vbo support
+    Draw_Vertex *vertices;
+    uint64_t last_used;
+} Tile_Chunk_Mesh;
+
+typedef struct Tile_Renderer {
+    Sys_Memory memory;
+    int has_vbo;
+    Tile_Chunk_Mesh mesh[TILE_CACHE_SIZE];
+} Tile_Renderer;
+
+// one record per sprite, expanded into a quad when the batch is flushed
+typedef struct Sprite_Instance {
+    float x, y;
+    uint32_t atlas; // row * columns + column in the sprite sheet
+} Sprite_Instance;
+
+typedef struct Sprite_Batch {
+    int count;
+    int capacity;
+    Sys_Memory memory;
+    Sprite_Instance *instances;
+    Draw_Vertex *vertices; // only used without vbo support
+    unsigned int buffer; // streamed vbo, 0 without vbo support
+    int has_vbo;
+} Sprite_Batch;
+
 typedef struct Game_State {
     Sprite_Sheet sprite_sheet;
     Vec2 mouse_released;
     Vec2 mouse_pressed;
     Vec2 camera;
-    Tile tile[MAP_GRID_SIZE][MAP_GRID_SIZE];
-    int ally_count;
-    Unit ally[MAX_ARMY_SIZE];
-    int enemy_count;
-    Unit enemy[MAX_ARMY_SIZE];
+    Map map;
+    uint64_t map_seed;
+    Path_Finder path_finder;
+    Path_Graph path_graph;
+    Flow_Field_Set flow_fields;
+    Tile_Renderer tile_renderer;
+    Sprite_Batch sprite_batch;
+    Army ally;
+    Army enemy;
     int selection_count;
-    Unit *selection[MAX_ARMY_SIZE];
+    int selection_capacity;
+    Sys_Memory selection_memory;
+    Unit_Handle *selection; // into ally
+    Sys_Rand rand; // gameplay randomness, seeded from map_seed
     float resource_ticks;
+    float enemy_spawn_time;
+    Flow_Field_Set horde_fields; // enemies out of sight of an ally follow these
+    int horde_field; // -1 before the first build
+    float horde_field_time;
+    float sim_accumulator;
+    float sim_alpha; // how far drawing is between the last two steps
+    uint64_t tick; // simulation steps
+    uint64_t frame;
+    uint64_t frame_limit; // headless only, 0 runs forever
 } Game_State;
 
+//=============================================================================
+//
+//
+//  PROFILER
+//
+//
+//=============================================================================
+// NOTE: blocks are timed on the main thread only, work inside the jobs shows
+// up in the block around the parallel_for that ran it. a frame keeps the
+// first PROFILE_MAX_BLOCKS blocks in the order they were opened. every block
+// is also a trace event, the jobs trace themselves with sys_trace_begin.
+#define PROFILE_FRAMES 128 // ring of the last frames
+#define PROFILE_MAX_BLOCKS 64
+#define PROFILE_MAX_DEPTH 8
+#define PROFILE_AVERAGE_FRAMES 32
+
+typedef struct Profile_Block {
+    const char *name; // string literals, blocks are matched by pointer
+    uint64_t start;
+    uint64_t end;
+    int depth;
+    int units; // units the block stepped, for the time per unit
+} Profile_Block;
+
+typedef struct Profile_Frame {
+    uint64_t start;
+    uint64_t end;
+    int count;
+    Profile_Block block[PROFILE_MAX_BLOCKS];
+} Profile_Frame;
+
+typedef struct Profiler {
+    Profile_Frame frame[PROFILE_FRAMES];
+    uint64_t frame_count; // frames begun, the newest is still being recorded
+    uint64_t frequency;
+    int open[PROFILE_MAX_DEPTH]; // block index per open depth, -1 when dropped
+    int depth;
+    int show; // overlay, toggled with F4
+} Profiler;
+
+static Profiler profiler;
+
+// times the statement or block after it. don't break or return out of it,
+// use profile_begin/profile_end around code that does
+#define PROFILE_BLOCK(name) \
+    for(int profile_once = (profile_begin(name), 1); profile_once; profile_once = (profile_end(), 0))
+
+static inline Profile_Frame *profile_frame(uint64_t frame) {
+    return &profiler.frame[frame % PROFILE_FRAMES];
+}
+
+void profile_frame_begin(void) {
+    if(!profiler.frequency) {
+        profiler.frequency = sys_time_frequency();
+    }
+    Profile_Frame *frame = profile_frame(profiler.frame_count++);
+    frame->count = 0;
+    frame->start = sys_time_ticks();
+    frame->end = frame->start;
+    profiler.depth = 0;
+}
+
+void profile_frame_end(void) {
+    profile_frame(profiler.frame_count - 1)->end = sys_time_ticks();
+}
+
+void profile_begin(const char *name) {
+    sys_trace_begin(name);
+    int index = -1;
+    Profile_Frame *frame = profile_frame(profiler.frame_count - 1);
+    if(profiler.frame_count && profiler.depth < PROFILE_MAX_DEPTH && frame->count < PROFILE_MAX_BLOCKS) {
+        index = frame->count++;
+        Profile_Block *block = &frame->block[index];
+        block->name = name;
+        block->depth = profiler.depth;
+        block->units = 0;
+        block->start = sys_time_ticks();
+        block->end = block->start;
+    }
+    if(profiler.depth < PROFILE_MAX_DEPTH) {
+        profiler.open[profiler.depth] = index;
+    }
+    profiler.depth++;
+}
+
+void profile_end(void) {
+    profiler.depth--;
+    if(profiler.depth < PROFILE_MAX_DEPTH && profiler.open[profiler.depth] >= 0) {
+        profile_frame(profiler.frame_count - 1)->block[profiler.open[profiler.depth]].end = sys_time_ticks();
+    }
+    sys_trace_end();
+}
+
+// adds to the unit count of the innermost open block
+void profile_units(int units) {
+    int depth = profiler.depth - 1;
+    if(depth >= 0 && depth < PROFILE_MAX_DEPTH && profiler.open[depth] >= 0) {
+        profile_frame(profiler.frame_count - 1)->block[profiler.open[depth]].units += units;
+    }
+}
+
+static inline double profile_ms(uint64_t ticks) {
+    return (double)ticks * 1000.0 / (double)profiler.frequency;
+}
+
+// average ms per frame of the blocks named name over the last finished
+// frames, unit_ns gets the average time per unit or 0 without units
+double profile_average(const char *name, double *unit_ns) {
+    uint64_t finished = profiler.frame_count ? profiler.frame_count - 1 : 0;
+    uint64_t frames = finished < PROFILE_AVERAGE_FRAMES ? finished : PROFILE_AVERAGE_FRAMES;
+    uint64_t ticks = 0;
+    uint64_t unit_ticks = 0;
+    uint64_t units = 0;
+    for(uint64_t f = finished - frames; f < finished; f++) {
+        Profile_Frame *frame = profile_frame(f);
+        for(int b = 0; b < frame->count; b++) {
+            Profile_Block *block = &frame->block[b];
+            if(block->name == name) {
+                ticks += block->end - block->start;
+                if(block->units) {
+                    unit_ticks += block->end - block->start;
+                    units += (uint64_t)block->units;
+                }
+            }
+        }
+    }
+    *unit_ns = units ? profile_ms(unit_ticks) * 1e6 / (double)units : 0.0;
+    return frames ? profile_ms(ticks) / (double)frames : 0.0;
+}
+
+// one line per block of the last finished frame, averaged
+void profile_report(FILE *out) {
+    if(profiler.frame_count < 2) {
+        return;
+    }
+    Profile_Frame *frame = profile_frame(profiler.frame_count - 2);
+    fprintf(out, "profile, average of the last %d frames\n", PROFILE_AVERAGE_FRAMES);
+    for(int b = 0; b < frame->count; b++) {
+        Profile_Block *block = &frame->block[b];
+        double unit_ns;
+        double ms = profile_average(block->name, &unit_ns);
+        fprintf(out, "%*s%-*s %8.3f ms", block->depth * 2, "", 24 - block->depth * 2, block->name, ms);
+        if(unit_ns > 0.0) {
+            fprintf(out, " %8.1f ns/unit", unit_ns);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+//=============================================================================
+//
+//
+//  REPLAY
+//
+//
+//=============================================================================
+// NOTE: a replay is the map seed and then one record per frame holding what
+// changed in the part of Sys_State the game reads: dt, the mouse, the window
+// size and the keys that flipped. gameplay only draws from state->rand, so
+// feeding the records back into loop() plays the same game again.
+#define REPLAY_MAGIC 0x3034444c // "LD40"
+#define REPLAY_VERSION 1
+#define REPLAY_BUFFER_SIZE (64 * 1024)
+#define REPLAY_RECORD_DT 0x01
+#define REPLAY_RECORD_MOUSE 0x02
+#define REPLAY_RECORD_SIZE 0x04
+#define REPLAY_RECORD_KEYS 0x08
+// flags, dt, mouse, size, key count and a byte per flipped key
+#define REPLAY_MAX_RECORD (1 + 4 + 4 + 4 + 1 + SYS_KEY_COUNT)
+
+typedef enum Replay_Mode {
+    REPLAY_OFF,
+    REPLAY_RECORD,
+    REPLAY_PLAY,
+} Replay_Mode;
+
+typedef struct Replay_Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seed;
+    uint64_t frames; // written when the recording stops
+} Replay_Header;
+
+typedef struct Replay {
+    Replay_Mode mode;
+    Sys_File file;
+    Sys_Memory memory; // the write buffer when recording
+    Sys_File_View view; // the records when playing, read in place
+    uint8_t *data;
+    uint64_t used; // bytes in the buffer or the read cursor
+    uint64_t size;
+    uint64_t offset; // file offset of the buffer when recording
+    Replay_Header header;
+    // the input after the last record, both sides start from zero
+    float dt;
+    int16_t mouse_x, mouse_y;
+    uint16_t width, height;
+    uint64_t keys[SYS_KEY_WORDS];
+} Replay;
+
+static Replay replay;
+
+static void replay_flush(void) {
+    sys_file_write(replay.file, replay.offset, replay.used, replay.data);
+    replay.offset += replay.used;
+    replay.used = 0;
+}
+
+static inline void replay_put(const void *source, uint64_t size) {
+    memcpy(replay.data + replay.used, source, size);
+    replay.used += size;
+}
+
+static inline int replay_get(void *destination, uint64_t size) {
+    if(replay.used + size > replay.size) {
+        return 0;
+    }
+    memcpy(destination, replay.data + replay.used, size);
+    replay.used += size;
+    return 1;
+}
+
+void replay_record_start(const char *file_name, uint64_t seed) {
+    replay.file = sys_file_open(file_name);
+    if(!replay.file.ptr) {
+        return;
+    }
+    sys_file_set_size(&replay.file, 0);
+    replay.header.magic = REPLAY_MAGIC;
+    replay.header.version = REPLAY_VERSION;
+    replay.header.seed = seed;
+    replay.header.frames = 0;
+    replay.memory = sys_alloc(REPLAY_BUFFER_SIZE, 0);
+    replay.data = (uint8_t *)replay.memory.ptr;
+    replay.size = REPLAY_BUFFER_SIZE;
+    replay.offset = sizeof(Replay_Header);
+    replay.mode = REPLAY_RECORD;
+}
+
+// returns the seed to generate the map with, 0 when the file isn't a replay
+uint64_t replay_play_start(const char *file_name) {
+    replay.file = sys_file_open_read(file_name);
+    if(!replay.file.ptr) {
+        return 0;
+    }
+    if(replay.file.size < sizeof(Replay_Header)
+       || sys_file_read(replay.file, 0, sizeof(Replay_Header), &replay.header) != sizeof(Replay_Header)
+       || replay.header.magic != REPLAY_MAGIC || replay.header.version != REPLAY_VERSION) {
+        printf("%s is not a replay\n", file_name);
+        sys_file_close(replay.file);
+        return 0;
+    }
+    replay.view = sys_file_map(replay.file, sizeof(Replay_Header), 0, SYS_FILE_MAP_READ);
+    sys_file_close(replay.file);
+    replay.data = (uint8_t *)replay.view.ptr;
+    replay.size = replay.view.size;
+    replay.used = 0;
+    replay.mode = REPLAY_PLAY;
+    printf("replaying %s, seed %" PRIu64 ", %" PRIu64 " frames\n", file_name, replay.header.seed, replay.header.frames);
+    return replay.header.seed;
+}
+
+void replay_stop(void) {
+    if(replay.mode == REPLAY_RECORD) {
+        replay_flush();
+        sys_file_write(replay.file, 0, sizeof(Replay_Header), &replay.header);
+        sys_file_close(replay.file);
+        sys_free(replay.memory);
+    } else if(replay.mode == REPLAY_PLAY) {
+        sys_file_unmap(replay.view);
+    }
+    replay.mode = REPLAY_OFF;
+}
+
+static void replay_record(Sys_State *sys) {
+    if(replay.used + REPLAY_MAX_RECORD > replay.size) {
+        replay_flush();
+    }
+    uint8_t *flags = replay.data + replay.used++;
+    *flags = 0;
+
+    if(sys->dt != replay.dt) {
+        *flags |= REPLAY_RECORD_DT;
+        replay.dt = sys->dt;
+        replay_put(&replay.dt, sizeof(replay.dt));
+    }
+    if(sys->mouse.x != replay.mouse_x || sys->mouse.y != replay.mouse_y) {
+        *flags |= REPLAY_RECORD_MOUSE;
+        replay.mouse_x = (int16_t)sys->mouse.x;
+        replay.mouse_y = (int16_t)sys->mouse.y;
+        replay_put(&replay.mouse_x, sizeof(replay.mouse_x));
+        replay_put(&replay.mouse_y, sizeof(replay.mouse_y));
+    }
+    if(sys->width != replay.width || sys->height != replay.height) {
+        *flags |= REPLAY_RECORD_SIZE;
+        replay.width = (uint16_t)sys->width;
+        replay.height = (uint16_t)sys->height;
+        replay_put(&replay.width, sizeof(replay.width));
+        replay_put(&replay.height, sizeof(replay.height));
+    }
+
+    // NOTE: compare against the last recorded keys rather than prev_keys so
+    // nothing is dropped if recording starts mid-session or skips a frame
+    uint64_t any = 0;
+    for(int i = 0; i < SYS_KEY_WORDS; i++) {
+        any |= sys->keys[i] ^ replay.keys[i];
+    }
+    if(any) {
+        *flags |= REPLAY_RECORD_KEYS;
+        uint8_t *count = replay.data + replay.used++;
+        *count = 0;
+        for(int i = 0; i < SYS_KEY_WORDS; i++) {
+            uint64_t bits = sys->keys[i] ^ replay.keys[i];
+            replay.keys[i] = sys->keys[i];
+            // NOTE: never more than a handful per frame, far from 256
+            while(bits) {
+                replay.data[replay.used++] = (uint8_t)(i * 64 + sys_lowest_bit(bits));
+                (*count)++;
+                bits &= bits - 1;
+            }
+        }
+    }
+    replay.header.frames++;
+}
+
+// returns 0 once the records run out
+static int replay_play(Sys_State *sys) {
+    uint8_t flags;
+    if(!replay_get(&flags, sizeof(flags))) {
+        return 0;
+    }
+    int ok = 1;
+    if(flags & REPLAY_RECORD_DT) {
+        ok &= replay_get(&replay.dt, sizeof(replay.dt));
+    }
+    if(flags & REPLAY_RECORD_MOUSE) {
+        ok &= replay_get(&replay.mouse_x, sizeof(replay.mouse_x));
+        ok &= replay_get(&replay.mouse_y, sizeof(replay.mouse_y));
+    }
+    if(flags & REPLAY_RECORD_SIZE) {
+        ok &= replay_get(&replay.width, sizeof(replay.width));
+        ok &= replay_get(&replay.height, sizeof(replay.height));
+    }
+    if(flags & REPLAY_RECORD_KEYS) {
+        uint8_t count = 0;
+        ok &= replay_get(&count, sizeof(count));
+        for(int k = 0; ok && k < count; k++) {
+            uint8_t key = 0;
+            ok &= replay_get(&key, sizeof(key));
+            replay.keys[key / 64] ^= 1ull << (key % 64);
+        }
+    }
+    if(!ok) {
+        return 0;
+    }
+
+    sys->dt = replay.dt;
+    sys->mouse.x = replay.mouse_x;
+    sys->mouse.y = replay.mouse_y;
+    sys->width = replay.width;
+    sys->height = replay.height;
+    for(int i = 0; i < SYS_KEY_WORDS; i++) {
+        sys->keys[i] = replay.keys[i];
+    }
+    return 1;
+}
+
+// records the input of the frame or replaces it with the next record,
+// returns 0 when a replay just ended
+int replay_frame(Sys_State *sys) {
+    if(replay.mode == REPLAY_RECORD) {
+        replay_record(sys);
+    } else if(replay.mode == REPLAY_PLAY && !replay_play(sys)) {
+        replay_stop();
+        return 0;
+    }
+    return 1;
+}
+
+//=============================================================================
+//
+//
+//  TERRAIN GENERATION
+//
+//
+//=============================================================================
+// two fields of value noise, elevation places lakes and rock fields and
+// vegetation places forests and shrubs on the land in between. the lattice
+// is hashed from world coordinates so chunks line up without sharing state.
+#define TERRAIN_OCTAVES 4
+#define TERRAIN_PERIOD 64 // lattice spacing of the first octave, halves every octave
+#define TERRAIN_WATER_LEVEL 0.34f
+#define TERRAIN_ROCK_LEVEL 0.66f
+#define TERRAIN_FOREST_LEVEL 0.56f
+#define TERRAIN_SHRUB_LEVEL 0.51f
+#define TERRAIN_VEGETATION_SALT 0x9e3779b97f4a7c15ULL
+#define TERRAIN_DETAIL_SALT 0xc2b2ae3d27d4eb4fULL
+
+static inline uint32_t terrain_hash(uint64_t seed, int x, int y) {
+    uint32_t h = (uint32_t)seed ^ (uint32_t)(seed >> 32);
+    h ^= (uint32_t)x * 0x8da6b343u;
+    h ^= (uint32_t)y * 0xd8163841u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline float terrain_lattice(uint64_t seed, int x, int y) {
+    return (terrain_hash(seed, x, y) >> 8) * (1.0f / 16777216.0f);
+}
+
+// out[i] += amplitude * lerp(a[i], b[i], fade(t[i])), the same ops in the
+// same order on every path so the map does not depend on the instruction set
+static void terrain_accumulate(float *out, const float *a, const float *b, const float *t, float amplitude, int count) {
+    int i = 0;
+#if defined(GAME_SIMD_AVX2)
+    const __m256 vamplitude = _mm256_set1_ps(amplitude);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    for(; i + 8 <= count; i += 8) {
+        __m256 vt = _mm256_loadu_ps(t + i);
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = _mm256_loadu_ps(b + i);
+        __m256 fade = _mm256_mul_ps(_mm256_mul_ps(vt, vt), _mm256_sub_ps(three, _mm256_mul_ps(two, vt)));
+        __m256 value = _mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(vb, va), fade));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(vamplitude, value)));
+    }
+#elif defined(GAME_SIMD_SSE2)
+    const __m128 vamplitude = _mm_set1_ps(amplitude);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 three = _mm_set1_ps(3.0f);
+    for(; i + 4 <= count; i += 4) {
+        __m128 vt = _mm_loadu_ps(t + i);
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 vb = _mm_loadu_ps(b + i);
+        __m128 fade = _mm_mul_ps(_mm_mul_ps(vt, vt), _mm_sub_ps(three, _mm_mul_ps(two, vt)));
+        __m128 value = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), fade));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(vamplitude, value)));
+    }
+#endif
+    for(; i < count; i++) {
+        float fade = (t[i] * t[i]) * (3.0f - 2.0f * t[i]);
+        out[i] += amplitude * (a[i] + (b[i] - a[i]) * fade);
+    }
+}
+
+// fills out with MAP_CHUNK_SIZE noise values in [0, 1) starting at (x0, y)
+static void terrain_noise_row(uint64_t seed, int x0, int y, float *out) {
+    float a[MAP_CHUNK_SIZE];
+    float b[MAP_CHUNK_SIZE];
+    float t[MAP_CHUNK_SIZE];
+    float column[MAP_CHUNK_SIZE + 2];
+    float amplitude = 0.5f / (1.0f - 1.0f / (1 << TERRAIN_OCTAVES)); // octaves sum to 1
+    int period = TERRAIN_PERIOD;
+
+    memset(out, 0, sizeof(float) * MAP_CHUNK_SIZE);
+    for(int octave = 0; octave < TERRAIN_OCTAVES; octave++) {
+        uint64_t octave_seed = seed + (uint64_t)octave * TERRAIN_DETAIL_SALT;
+        int iy = y / period;
+        float fy = (float)(y % period) / period;
+        fy = (fy * fy) * (3.0f - 2.0f * fy);
+
+        // the row only touches a few lattice columns, blend those along y once
+        int ix0 = x0 / period;
+        int columns = (x0 + MAP_CHUNK_SIZE - 1) / period - ix0 + 2;
+        for(int c = 0; c < columns; c++) {
+            float v0 = terrain_lattice(octave_seed, ix0 + c, iy);
+            float v1 = terrain_lattice(octave_seed, ix0 + c, iy + 1);
+            column[c] = v0 + (v1 - v0) * fy;
+        }
+        for(int i = 0; i < MAP_CHUNK_SIZE; i++) {
+            int x = x0 + i;
+            int c = x / period - ix0;
+            a[i] = column[c];
+            b[i] = column[c + 1];
+            t[i] = (float)(x % period) / period;
+        }
+
+        terrain_accumulate(out, a, b, t, amplitude, MAP_CHUNK_SIZE);
+        amplitude *= 0.5f;
+        period >>= 1;
+    }
+}
+
+static inline int terrain_classify(float elevation, float vegetation, uint32_t detail) {
+    float roll = (detail >> 8) * (1.0f / 16777216.0f);
+    if(elevation < TERRAIN_WATER_LEVEL) {
+        return TILE_TYPE_WATER;
+    }
+    if(elevation > TERRAIN_ROCK_LEVEL) {
+        return roll < 0.85f ? TILE_TYPE_ROCK : TILE_TYPE_GRASS;
+    }
+    if(vegetation > TERRAIN_FOREST_LEVEL && roll < 0.8f) {
+        return TILE_TYPE_TREE + (int)(detail % 3);
+    }
+    if(vegetation > TERRAIN_SHRUB_LEVEL && roll < 0.3f) {
+        return TILE_TYPE_SHRUB + (int)(detail & 1);
+    }
+    return roll < 0.01f ? TILE_TYPE_TREE : TILE_TYPE_GRASS;
+}
+
+// terrain_noise_row for a single tile, the same ops in the same order so a
+// tile reads the same whether its chunk was generated or not
+static float terrain_noise(uint64_t seed, int x, int y) {
+    float out = 0.0f;
+    float amplitude = 0.5f / (1.0f - 1.0f / (1 << TERRAIN_OCTAVES));
+    int period = TERRAIN_PERIOD;
+    for(int octave = 0; octave < TERRAIN_OCTAVES; octave++) {
+        uint64_t octave_seed = seed + (uint64_t)octave * TERRAIN_DETAIL_SALT;
+        int ix = x / period;
+        int iy = y / period;
+        float fy = (float)(y % period) / period;
+        fy = (fy * fy) * (3.0f - 2.0f * fy);
+        float a0 = terrain_lattice(octave_seed, ix, iy);
+        float a1 = terrain_lattice(octave_seed, ix, iy + 1);
+        float b0 = terrain_lattice(octave_seed, ix + 1, iy);
+        float b1 = terrain_lattice(octave_seed, ix + 1, iy + 1);
+        float a = a0 + (a1 - a0) * fy;
+        float b = b0 + (b1 - b0) * fy;
+        float t = (float)(x % period) / period;
+        float fade = (t * t) * (3.0f - 2.0f * t);
+        out += amplitude * (a + (b - a) * fade);
+        amplitude *= 0.5f;
+        period >>= 1;
+    }
+    return out;
+}
+
+static inline Tile terrain_make_tile(int type) {
+    Tile tile = { (unsigned char)type, (unsigned char)(10 * type) };
+    return tile;
+}
+
+static Tile terrain_tile(uint64_t seed, int x, int y) {
+    float elevation = terrain_noise(seed, x, y);
+    float vegetation = terrain_noise(seed ^ TERRAIN_VEGETATION_SALT, x, y);
+    return terrain_make_tile(terrain_classify(elevation, vegetation, terrain_hash(seed ^ TERRAIN_DETAIL_SALT, x, y)));
+}
+
+// a tile only depends on the seed and its position, never on which thread
+// got which chunk or on when it was generated
+static void terrain_fill(uint64_t seed, Map_Chunk *chunk, int chunk_x, int chunk_y) {
+    uint64_t vegetation_seed = seed ^ TERRAIN_VEGETATION_SALT;
+    uint64_t detail_seed = seed ^ TERRAIN_DETAIL_SALT;
+    float elevation[MAP_CHUNK_SIZE];
+    float vegetation[MAP_CHUNK_SIZE];
+    int x0 = chunk_x * MAP_CHUNK_SIZE;
+    int y0 = chunk_y * MAP_CHUNK_SIZE;
+    for(int j = 0; j < MAP_CHUNK_SIZE; j++) {
+        terrain_noise_row(seed, x0, y0 + j, elevation);
+        terrain_noise_row(vegetation_seed, x0, y0 + j, vegetation);
+        for(int i = 0; i < MAP_CHUNK_SIZE; i++) {
+            int t = terrain_classify(elevation[i], vegetation[i], terrain_hash(detail_seed, x0 + i, y0 + j));
+            chunk->tile[i][j] = terrain_make_tile(t);
+        }
+    }
+}
+
+//=============================================================================
+//
+//
+//  MAP
+//
+//
+//=============================================================================
+static const Tile map_default_tile = { TILE_TYPE_GRASS, 0 };
+
+void map_init(Map *map, int size) {
+    memset(map, 0, sizeof(*map));
+    map->size = size;
+    map->chunk_count = size / MAP_CHUNK_SIZE;
+    map->table_memory = sys_alloc(sizeof(Map_Chunk *) * map->chunk_count * map->chunk_count, 0);
+    map->chunk = (Map_Chunk **)map->table_memory.ptr;
+    memset(map->chunk, 0, sizeof(Map_Chunk *) * map->chunk_count * map->chunk_count);
+}
+
+void map_free(Map *map) {
+    Map_Block *block = map->blocks;
+    while(block) {
+        Map_Block *next = block->next;
+        sys_free(block->memory);
+        block = next;
+    }
+    if(map->table_memory.ptr) {
+        sys_free(map->table_memory);
+    }
+    sys_file_unmap(map->view);
+    memset(map, 0, sizeof(*map));
+}
+
+static inline int map_chunk_coord(Map *map, int t) {
+    int c = t / MAP_CHUNK_SIZE;
+    return c < 0 ? 0 : (c >= map->chunk_count ? map->chunk_count - 1 : c);
+}
+
+static inline int map_in_bounds(Map *map, int x, int y) {
+    return x >= 0 && y >= 0 && x < map->size && y < map->size;
+}
+
+// 0 until the chunk is carved
+static inline Map_Chunk *map_chunk(Map *map, int chunk_x, int chunk_y) {
+    return map->chunk[chunk_y * map->chunk_count + chunk_x];
+}
+
+// the chunk's tiles are left uninitialized
+// NOTE: not thread safe, carve up front before filling chunks from jobs
+static Map_Chunk *map_chunk_carve(Map *map, int chunk_x, int chunk_y) {
+    Map_Chunk **slot = &map->chunk[chunk_y * map->chunk_count + chunk_x];
+    if(*slot) {
+        return *slot;
+    }
+
+    if(!map->block_free) {
+        Sys_Memory memory = sys_alloc(sizeof(Map_Block) + sizeof(Map_Chunk) * MAP_CHUNKS_PER_BLOCK, 0);
+        Map_Block *block = (Map_Block *)memory.ptr;
+        block->memory = memory;
+        block->next = map->blocks;
+        map->blocks = block;
+        map->block_next = (Map_Chunk *)(block + 1);
+        map->block_free = MAP_CHUNKS_PER_BLOCK;
+    }
+
+    Map_Chunk *chunk = map->block_next++;
+    map->block_free--;
+    map->chunks_allocated++;
+    chunk->version = 0;
+    *slot = chunk;
+    return chunk;
+}
+
+// the tiles a chunk has before anything writes to it
+static void map_chunk_fill(Map *map, Map_Chunk *chunk, int chunk_x, int chunk_y) {
+    if(map->generated) {
+        terrain_fill(map->seed, chunk, chunk_x, chunk_y);
+        return;
+    }
+    for(int i = 0; i < MAP_CHUNK_SIZE; i++) {
+        for(int j = 0; j < MAP_CHUNK_SIZE; j++) {
+            chunk->tile[i][j] = map_default_tile;
+        }
+    }
+}
+
+Map_Chunk *map_chunk_alloc(Map *map, int chunk_x, int chunk_y) {
+    if(map_chunk(map, chunk_x, chunk_y)) {
+        return map_chunk(map, chunk_x, chunk_y);
+    }
+    Map_Chunk *chunk = map_chunk_carve(map, chunk_x, chunk_y);
+    map_chunk_fill(map, chunk, chunk_x, chunk_y);
+    return chunk;
+}
+
+// the chunk for reading, generated and kept the first time it is touched.
+// 0 when it would only hold map_default_tile
+// NOTE: carves, main thread only. jobs read through map_get
+static Map_Chunk *map_chunk_touch(Map *map, int chunk_x, int chunk_y) {
+    Map_Chunk *chunk = map_chunk(map, chunk_x, chunk_y);
+    return chunk || !map->generated ? chunk : map_chunk_alloc(map, chunk_x, chunk_y);
+}
+
+// copies the chunks used in place from a snapshot into blocks of their own
+// and lets go of the file
+void map_make_private(Map *map) {
+    if(!map->view.ptr) {
+        return;
+    }
+    Map_Chunk *first = (Map_Chunk *)map->view.ptr;
+    Map_Chunk *last = first + map->view.size / sizeof(Map_Chunk);
+    for(int chunk_y = 0; chunk_y < map->chunk_count; chunk_y++) {
+        for(int chunk_x = 0; chunk_x < map->chunk_count; chunk_x++) {
+            Map_Chunk **slot = &map->chunk[chunk_y * map->chunk_count + chunk_x];
+            Map_Chunk *mapped = *slot;
+            if(mapped >= first && mapped < last) {
+                *slot = 0;
+                map->chunks_allocated--;
+                memcpy(map_chunk_carve(map, chunk_x, chunk_y), mapped, sizeof(Map_Chunk));
+            }
+        }
+    }
+    sys_file_unmap(map->view);
+    memset(&map->view, 0, sizeof(map->view));
+}
+
+static inline Tile map_get(Map *map, int x, int y) {
+    if(!map_in_bounds(map, x, y)) {
+        return map_default_tile;
+    }
+    Map_Chunk *chunk = map_chunk(map, x / MAP_CHUNK_SIZE, y / MAP_CHUNK_SIZE);
+    if(chunk) {
+        return chunk->tile[x % MAP_CHUNK_SIZE][y % MAP_CHUNK_SIZE];
+    }
+    return map->generated ? terrain_tile(map->seed, x, y) : map_default_tile;
+}
+
+// writable tile, allocating its chunk, 0 when out of bounds
+static inline Tile *map_tile(Map *map, int x, int y) {
+    if(!map_in_bounds(map, x, y)) {
+        return 0;
+    }
+    Map_Chunk *chunk = map_chunk_alloc(map, x / MAP_CHUNK_SIZE, y / MAP_CHUNK_SIZE);
+    return &chunk->tile[x % MAP_CHUNK_SIZE][y % MAP_CHUNK_SIZE];
+}
+
+static inline uint32_t map_chunk_version(Map *map, int chunk_x, int chunk_y) {
+    Map_Chunk *chunk = map_chunk(map, chunk_x, chunk_y);
+    return chunk ? chunk->version : 0;
+}
+
+void map_set_type(Map *map, int x, int y, int type) {
+    Tile *tile = map_tile(map, x, y);
+    if(tile) {
+        tile->type = (unsigned char)type;
+        map_chunk(map, x / MAP_CHUNK_SIZE, y / MAP_CHUNK_SIZE)->version++;
+        map->version++;
+    }
+}
+
+typedef struct Map_Generate_Job {
+    Map *map;
+    int chunk_x0;
+    int chunk_y0;
+    int width; // chunks per row of the box
+} Map_Generate_Job;
+
+static void map_generate_chunks(void *data, int start, int end) {
+    Map_Generate_Job *job = (Map_Generate_Job *)data;
+    sys_trace_begin("map chunks");
+    for(int c = start; c < end; c++) {
+        int chunk_x = job->chunk_x0 + c % job->width;
+        int chunk_y = job->chunk_y0 + c / job->width;
+        terrain_fill(job->map->seed, map_chunk(job->map, chunk_x, chunk_y), chunk_x, chunk_y);
+    }
+    sys_trace_end();
+}
+
+// the fresh map's tiles come from the seed from now on. chunks are generated
+// the first time they are touched, the ones in the box (tiles, inclusive)
+// right away on jobs
+void map_generate(Map *map, uint64_t seed, int left, int top, int right, int bottom) {
+    sys_assert(!map->chunks_allocated);
+    map->seed = seed;
+    map->generated = 1;
+
+    // NOTE: carved up front on this thread, the jobs only fill them
+    int chunk_x0 = map_chunk_coord(map, left);
+    int chunk_y0 = map_chunk_coord(map, top);
+    int width = map_chunk_coord(map, right) - chunk_x0 + 1;
+    int height = map_chunk_coord(map, bottom) - chunk_y0 + 1;
+    for(int c = 0; c < width * height; c++) {
+        map_chunk_carve(map, chunk_x0 + c % width, chunk_y0 + c / width);
+    }
+
+    Map_Generate_Job job = { map, chunk_x0, chunk_y0, width };
+    Sys_Job_Counter counter = { 0 };
+    sys_job_parallel_for(map_generate_chunks, &job, width * height, 16, &counter);
+    sys_job_wait(&counter);
+}
+
+// columns start on a cache line so the movement pass can use aligned loads
+static size_t army_column_size(size_t element_size, int capacity) {
+    return (element_size * (size_t)capacity + 63) & ~(size_t)63;
+}
+
+static void *army_carve(unsigned char **p, void *old, size_t element_size, int capacity, size_t copy_count) {
+    void *column = *p;
+    *p += army_column_size(element_size, capacity);
+    if(old && copy_count) {
+        memcpy(column, old, element_size * copy_count);
+    }
+    return column;
+}
+
+void army_reserve(Army *army, int capacity) {
+    if(capacity <= army->capacity) {
+        return;
+    }
+
+    size_t size = 0;
+#define ARMY_COLUMN_SIZE(T, name) size += army_column_size(sizeof(T), capacity);
+    ARMY_COLUMNS(ARMY_COLUMN_SIZE)
+#undef ARMY_COLUMN_SIZE
+    size += COOLDOWN_MAX * army_column_size(sizeof(float), capacity);
+    size += 4 * army_column_size(sizeof(uint32_t), capacity);
+    size += 8 * army_column_size(sizeof(int), capacity);
+    size += army_column_size(sizeof(Attack_Event), capacity);
+
+    Sys_Memory old_memory = army->memory;
+    Sys_Memory memory = sys_alloc(size, 0);
+    unsigned char *p = (unsigned char *)memory.ptr;
+    size_t count = (size_t)army->count;
+
+#define ARMY_CARVE_COLUMN(T, name) army->name = (T *)army_carve(&p, army->name, sizeof(T), capacity, count);
+    ARMY_COLUMNS(ARMY_CARVE_COLUMN)
+#undef ARMY_CARVE_COLUMN
+    for(int c = 0; c < COOLDOWN_MAX; c++) {
+        army->cooldown[c] = (float *)army_carve(&p, army->cooldown[c], sizeof(float), capacity, count);
+    }
+    army->slot_dense = (uint32_t *)army_carve(&p, army->slot_dense, sizeof(uint32_t), capacity, army->slot_count);
+    army->slot_generation = (uint32_t *)army_carve(&p, army->slot_generation, sizeof(uint32_t), capacity, army->slot_count);
+    army->slot_next = (uint32_t *)army_carve(&p, army->slot_next, sizeof(uint32_t), capacity, army->slot_count);
+    army->slot_prev = (uint32_t *)army_carve(&p, army->slot_prev, sizeof(uint32_t), capacity, army->slot_count);
+    army->moved = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+    army->moved_count = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+    army->stalled = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+    army->stalled_count = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+    army->events = (Attack_Event *)army_carve(&p, 0, sizeof(Attack_Event), capacity, 0);
+    army->event_count = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+    army->dead = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+    army->dead_count = (int *)army_carve(&p, 0, sizeof(int), capacity, 0);
+
+    if(old_memory.ptr) {
+        sys_free(old_memory);
+    }
+    army->memory = memory;
+    army->capacity = capacity;
+}
+
+void army_init(Army *army, int capacity) {
+    memset(army, 0, sizeof(*army));
+    army->free_slot = ARMY_NO_SLOT;
+    army_reserve(army, capacity);
+
+    army->grid_memory = sys_alloc(sizeof(uint32_t) * UNIT_CELLS_PER_ROW * UNIT_CELLS_PER_ROW, 0);
+    army->cell_head = (uint32_t *)army->grid_memory.ptr;
+    for(int i = 0; i < UNIT_CELLS_PER_ROW * UNIT_CELLS_PER_ROW; i++) {
+        army->cell_head[i] = ARMY_NO_SLOT;
+    }
+}
+
+void army_free(Army *army) {
+    if(army->memory.ptr) {
+        sys_free(army->memory);
+    }
+    if(army->grid_memory.ptr) {
+        sys_free(army->grid_memory);
+    }
+    if(army->path_memory.ptr) {
+        sys_free(army->path_memory);
+    }
+    memset(army, 0, sizeof(*army));
+}
+
+static inline int unit_cell_coord(float v) {
+    int c = (int)v / UNIT_CELL_SIZE;
+    return c < 0 ? 0 : (c >= UNIT_CELLS_PER_ROW ? UNIT_CELLS_PER_ROW - 1 : c);
+}
+
+static inline uint32_t unit_cell(float x, float y) {
+    return (uint32_t)(unit_cell_coord(y) * UNIT_CELLS_PER_ROW + unit_cell_coord(x));
+}
+
+static void army_link(Army *army, uint32_t slot, uint32_t cell) {
+    uint32_t head = army->cell_head[cell];
+    army->slot_prev[slot] = ARMY_NO_SLOT;
+    army->slot_next[slot] = head;
+    if(head != ARMY_NO_SLOT) {
+        army->slot_prev[head] = slot;
+    }
+    army->cell_head[cell] = slot;
+}
+
+static void army_unlink(Army *army, uint32_t slot, uint32_t cell) {
+    uint32_t prev = army->slot_prev[slot];
+    uint32_t next = army->slot_next[slot];
+    if(prev != ARMY_NO_SLOT) {
+        army->slot_next[prev] = next;
+    } else {
+        army->cell_head[cell] = next;
+    }
+    if(next != ARMY_NO_SLOT) {
+        army->slot_prev[next] = prev;
+    }
+}
+
+// NOTE: anything that writes x/y outside of the movement pass calls this
+void army_grid_update(Army *army, int i) {
+    uint32_t cell = unit_cell(army->x[i], army->y[i]);
+    if(cell != army->cell[i]) {
+        army_unlink(army, army->slot[i], army->cell[i]);
+        army_link(army, army->slot[i], cell);
+        army->cell[i] = cell;
+    }
+}
+
+// column index of a live unit, -1 for dead or stale handles
+static inline int army_index(Army *army, Unit_Handle handle) {
+    if(handle.index < army->slot_count && army->slot_generation[handle.index] == handle.generation) {
+        return (int)army->slot_dense[handle.index];
+    }
+    return -1;
+}
+
+static inline Unit_Handle army_handle(Army *army, int i) {
+    Unit_Handle handle;
+    handle.index = army->slot[i];
+    handle.generation = army->slot_generation[handle.index];
+    return handle;
+}
+
+Unit_Handle army_spawn(Army *army, int type, float x, float y) {
+    if(army->count >= army->capacity) {
+        army_reserve(army, army->capacity ? army->capacity * 2 : ARMY_START_CAPACITY);
+    }
+
+    uint32_t slot = army->free_slot;
+    if(slot != ARMY_NO_SLOT) {
+        army->free_slot = army->slot_dense[slot];
+    } else {
+        slot = army->slot_count++;
+        army->slot_generation[slot] = 0;
+    }
+
+    int i = army->count++;
+    army->slot_dense[slot] = (uint32_t)i;
+    army->slot[i] = slot;
+    army->x[i] = x;
+    army->y[i] = y;
+    army->prev_x[i] = x;
+    army->prev_y[i] = y;
+    army->look_x[i] = x;
+    army->look_y[i] = y;
+    army->speed[i] = UNIT_TILES_PER_SECOND;
+    army->flags[i] = 0;
+    army->type[i] = type;
+    army->hp[i] = START_HP;
+    army->resource[i] = 0;
+    army->animation_frame[i] = 0;
+    army->animation_time[i] = 0.0f;
+    army->path_start[i] = 0;
+    army->path_count[i] = 0;
+    army->path_next[i] = 0;
+    army->path_refined[i] = 0;
+    army->flow[i] = 0;
+    army->target[i].index = ARMY_NO_SLOT;
+    army->target[i].generation = 0;
+    army->damage[i] = 0;
+    for(int c = 0; c < COOLDOWN_MAX; c++) {
+        army->cooldown[c][i] = 0.0f;
+    }
+    army->cell[i] = unit_cell(x, y);
+    army_link(army, slot, army->cell[i]);
+    return army_handle(army, i);
+}
+
+void army_despawn(Army *army, Unit_Handle handle) {
+    int i = army_index(army, handle);
+    if(i < 0) {
+        return;
+    }
+
+    army_unlink(army, handle.index, army->cell[i]);
+
+    int last = army->count - 1;
+    if(i != last) {
+#define ARMY_MOVE_COLUMN(T, name) army->name[i] = army->name[last];
+        ARMY_COLUMNS(ARMY_MOVE_COLUMN)
+#undef ARMY_MOVE_COLUMN
+        for(int c = 0; c < COOLDOWN_MAX; c++) {
+            army->cooldown[c][i] = army->cooldown[c][last];
+        }
+        army->slot_dense[army->slot[i]] = (uint32_t)i;
+    }
+    army->count--;
+
+    army->slot_generation[handle.index]++;
+    army->slot_dense[handle.index] = army->free_slot;
+    army->free_slot = handle.index;
+}
+
+// moves the unwalked part of every path into a new pool with room for extra
+// more waypoints, finished and despawned paths are dropped
+static void army_path_compact(Army *army, uint32_t extra) {
+    uint32_t live = 0;
+    for(int i = 0; i < army->count; i++) {
+        live += army->path_count[i] - army->path_next[i];
+    }
+
+    uint32_t capacity = army->path_capacity ? army->path_capacity : PATH_START_CAPACITY;
+    while(capacity < 2 * (live + extra)) {
+        capacity *= 2;
+    }
+
+    Sys_Memory memory = sys_alloc(sizeof(Path_Point) * capacity, 0);
+    Path_Point *points = (Path_Point *)memory.ptr;
+    uint32_t used = 0;
+    for(int i = 0; i < army->count; i++) {
+        uint32_t remaining = army->path_count[i] - army->path_next[i];
+        if(remaining) {
+            memcpy(points + used, army->path_points + army->path_start[i] + army->path_next[i], sizeof(Path_Point) * remaining);
+        }
+        army->path_start[i] = used;
+        army->path_count[i] = remaining;
+        army->path_refined[i] -= army->path_next[i];
+        army->path_next[i] = 0;
+        used += remaining;
+    }
+
+    if(army->path_memory.ptr) {
+        sys_free(army->path_memory);
+    }
+    army->path_memory = memory;
+    army->path_points = points;
+    army->path_used = used;
+    army->path_capacity = capacity;
+}
+
+// NOTE: only call between steps, the update jobs read the pool
+void army_path_set(Army *army, int i, const Path_Point *points, uint32_t count) {
+    army->path_count[i] = 0;
+    army->path_next[i] = 0;
+    army->path_refined[i] = 0;
+    army->flags[i] &= ~(UNIT_FLAG_PATH | UNIT_FLAG_FLOW | UNIT_FLAG_MOVING);
+    if(!count) {
+        return;
+    }
+
+    if(army->path_used + count > army->path_capacity) {
+        army_path_compact(army, count);
+    }
+    memcpy(army->path_points + army->path_used, points, sizeof(Path_Point) * count);
+    army->path_start[i] = army->path_used;
+    army->path_count[i] = count;
+    army->path_refined[i] = count;
+    army->path_used += count;
+    army->flags[i] |= UNIT_FLAG_PATH;
+}
+
+// drops the path or flow field the unit follows
+void army_path_clear(Army *army, int i) {
+    army->path_next[i] = army->path_count[i];
+    army->path_refined[i] = army->path_count[i];
+    army->flags[i] &= ~(UNIT_FLAG_PATH | UNIT_FLAG_FLOW);
+}
+
+// a unit at (x, y) is drawn over tile (x + 1, y + 1), see draw_map
+static inline int unit_tile_coord(float v) {
+    return (int)floorf(v + 0.5f) + 1;
+}
+
+// heads for the next waypoint once the last one was reached, safe from the
+// update jobs since it only touches unit i. returns 1 when the unit waits
+// for army_path_refine, the rest of its path is cluster graph nodes
+static inline int army_path_advance(Army *army, int i) {
+    if(army->path_next[i] < army->path_refined[i]) {
+        Path_Point p = army->path_points[army->path_start[i] + army->path_next[i]++];
+        army->look_x[i] = (float)(p.x - 1);
+        army->look_y[i] = (float)(p.y - 1);
+        army->flags[i] |= UNIT_FLAG_MOVING;
+    } else if(army->path_next[i] < army->path_count[i]) {
+        return 1;
+    } else {
+        army->flags[i] &= ~UNIT_FLAG_PATH;
+    }
+    return 0;
+}
+
+void selection_clear(Game_State *state) {
+    state->selection_count = 0;
+}
+
+void selection_add(Game_State *state, Unit_Handle handle) {
+    if(state->selection_count >= state->selection_capacity) {
+        int capacity = state->selection_capacity ? state->selection_capacity * 2 : ARMY_START_CAPACITY;
+        Sys_Memory memory = sys_alloc(sizeof(Unit_Handle) * (size_t)capacity, 0);
+        if(state->selection_count) {
+            memcpy(memory.ptr, state->selection, sizeof(Unit_Handle) * (size_t)state->selection_count);
+        }
+        if(state->selection_memory.ptr) {
+            sys_free(state->selection_memory);
+        }
+        state->selection_memory = memory;
+        state->selection = (Unit_Handle *)memory.ptr;
+        state->selection_capacity = capacity;
+    }
+    state->selection[state->selection_count++] = handle;
+}
+
+// selects every ally inside the box, edges included
+void selection_add_rect(Game_State *state, float left, float top, float right, float bottom) {
+    Army *ally = &state->ally;
+    int cx0 = unit_cell_coord(left);
+    int cy0 = unit_cell_coord(top);
+    int cx1 = unit_cell_coord(right);
+    int cy1 = unit_cell_coord(bottom);
+
+    for(int cy = cy0; cy <= cy1; cy++) {
+        for(int cx = cx0; cx <= cx1; cx++) {
+            uint32_t slot = ally->cell_head[cy * UNIT_CELLS_PER_ROW + cx];
+            while(slot != ARMY_NO_SLOT) {
+                int i = (int)ally->slot_dense[slot];
+                if(ally->x[i] <= right && ally->x[i] >= left && ally->y[i] <= bottom && ally->y[i] >= top) {
+                    selection_add(state, army_handle(ally, i));
+                }
+                slot = ally->slot_next[slot];
+            }
+        }
+    }
+}
+
+// closest unit within radius, -1 when there is none. the cells are walked in
+// rings around (x, y) until no farther ring can hold anything closer
+int army_nearest(Army *army, float x, float y, float radius) {
+    int cx = unit_cell_coord(x);
+    int cy = unit_cell_coord(y);
+    int rings = (int)(radius / UNIT_CELL_SIZE) + 1;
+    int best = -1;
+    float best_d2 = radius * radius;
+
+    for(int r = 0; r <= rings; r++) {
+        int x0 = cx - r, x1 = cx + r;
+        int y0 = cy - r, y1 = cy + r;
+        for(int gy = y0; gy <= y1; gy++) {
+            if(gy < 0 || gy >= UNIT_CELLS_PER_ROW) { continue; }
+            // inner rows only have the two edge cells on this ring
+            int step = (gy == y0 || gy == y1) ? 1 : x1 - x0;
+            for(int gx = x0; gx <= x1; gx += step) {
+                if(gx < 0 || gx >= UNIT_CELLS_PER_ROW) { continue; }
+                uint32_t slot = army->cell_head[gy * UNIT_CELLS_PER_ROW + gx];
+                while(slot != ARMY_NO_SLOT) {
+                    int i = (int)army->slot_dense[slot];
+                    float dx = army->x[i] - x;
+                    float dy = army->y[i] - y;
+                    float d2 = dx * dx + dy * dy;
+                    if(d2 <= best_d2) {
+                        best_d2 = d2;
+                        best = i;
+                    }
+                    slot = army->slot_next[slot];
+                }
+            }
+        }
+
+        float reach = (float)(r * UNIT_CELL_SIZE);
+        if(best >= 0 && best_d2 <= reach * reach) {
+            break;
+        }
+    }
+    return best;
+}
+
+//=============================================================================
+//
+//
+//  PATHFINDING
+//
+//
+//=============================================================================
+// A* over tiles, 8 way with no corner cutting, octile heuristic
+#define PATH_DIAGONAL_COST 1.41421356f
+
+// straight steps first for the corner check, d ^ 1 is the opposite of d
+static const int path_dirs[8][2] = { {1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {-1,-1}, {1,-1}, {-1,1} };
+
+static inline int tile_walkable(int type, int flags) {
+    switch(type) {
+        case TILE_TYPE_GRASS:
+        case TILE_TYPE_WALKABLE:
+        case TILE_TYPE_SHRUB:
+        case TILE_TYPE_SHRUB_PURPLE:
+            return 1;
+        case TILE_TYPE_WATER:
+            return (flags & PATH_SWIM) != 0;
+        default:
+            return 0;
+    }
+}
+
+static inline int map_walkable(Map *map, int x, int y, int flags) {
+    return map_in_bounds(map, x, y) && tile_walkable(map_get(map, x, y).type, flags);
+}
+
+// map_walkable that keeps the chunks it generates, for searches that read
+// the same tiles over and over
+// NOTE: carves, main thread only
+static inline int map_walkable_touch(Map *map, int x, int y, int flags) {
+    if(!map_in_bounds(map, x, y)) {
+        return 0;
+    }
+    Map_Chunk *chunk = map_chunk_touch(map, x / MAP_CHUNK_SIZE, y / MAP_CHUNK_SIZE);
+    return tile_walkable((chunk ? chunk->tile[x % MAP_CHUNK_SIZE][y % MAP_CHUNK_SIZE] : map_default_tile).type, flags);
+}
+
+static inline float path_heuristic(int x0, int y0, int x1, int y1) {
+    int dx = x0 > x1 ? x0 - x1 : x1 - x0;
+    int dy = y0 > y1 ? y0 - y1 : y1 - y0;
+    int diagonal = dx < dy ? dx : dy;
+    return (float)(dx + dy) + (PATH_DIAGONAL_COST - 2.0f) * diagonal;
+}
+
+static inline uint32_t path_hash(uint32_t tile) {
+    tile ^= tile >> 16;
+    tile *= 0x7feb352du;
+    tile ^= tile >> 15;
+    return tile;
+}
+
+static void path_table_insert(Path_Finder *finder, uint32_t tile, uint32_t node) {
+    uint32_t mask = finder->capacity * 2 - 1;
+    uint32_t h = path_hash(tile) & mask;
+    while(finder->table[h].search == finder->search) {
+        h = (h + 1) & mask;
+    }
+    finder->table[h].search = finder->search;
+    finder->table[h].node = node;
+}
+
+static uint32_t path_table_find(Path_Finder *finder, uint32_t tile) {
+    uint32_t mask = finder->capacity * 2 - 1;
+    uint32_t h = path_hash(tile) & mask;
+    while(finder->table[h].search == finder->search) {
+        if(finder->nodes[finder->table[h].node].tile == tile) {
+            return finder->table[h].node;
+        }
+        h = (h + 1) & mask;
+    }
+    return PATH_NO_NODE;
+}
+
+// grows the arena keeping the nodes and heap of a search in flight
+static void path_finder_reserve(Path_Finder *finder, uint32_t capacity) {
+    if(capacity <= finder->capacity) {
+        return;
+    }
+
+    size_t node_size = sizeof(Path_Node) * capacity;
+    size_t heap_size = sizeof(uint32_t) * capacity;
+    Sys_Memory memory = sys_alloc(node_size + heap_size + sizeof(Path_Table_Entry) * capacity * 2, 0);
+    Path_Node *nodes = (Path_Node *)memory.ptr;
+    uint32_t *heap = (uint32_t *)((unsigned char *)memory.ptr + node_size);
+    Path_Table_Entry *table = (Path_Table_Entry *)((unsigned char *)memory.ptr + node_size + heap_size);
+    memset(table, 0, sizeof(Path_Table_Entry) * capacity * 2);
+    if(finder->node_count) {
+        memcpy(nodes, finder->nodes, sizeof(Path_Node) * finder->node_count);
+    }
+    if(finder->heap_count) {
+        memcpy(heap, finder->heap, sizeof(uint32_t) * finder->heap_count);
+    }
+
+    if(finder->memory.ptr) {
+        sys_free(finder->memory);
+    }
+    finder->memory = memory;
+    finder->capacity = capacity;
+    finder->nodes = nodes;
+    finder->heap = heap;
+    finder->table = table;
+    for(uint32_t n = 0; n < finder->node_count; n++) {
+        path_table_insert(finder, nodes[n].tile, n);
+    }
+}
+
+void path_finder_init(Path_Finder *finder) {
+    memset(finder, 0, sizeof(*finder));
+    path_finder_reserve(finder, PATH_START_CAPACITY);
+}
+
+// forgets the regions, for when the map is replaced under the finder
+void path_regions_free(Path_Finder *finder) {
+    for(int r = 0; r < 2; r++) {
+        Path_Regions *regions = &finder->regions[r];
+        if(regions->memory.ptr) {
+            sys_free(regions->memory);
+        }
+        if(regions->region_memory.ptr) {
+            sys_free(regions->region_memory);
+        }
+        memset(regions, 0, sizeof(*regions));
+    }
+}
+
+void path_finder_free(Path_Finder *finder) {
+    if(finder->memory.ptr) {
+        sys_free(finder->memory);
+    }
+    if(finder->result_memory.ptr) {
+        sys_free(finder->result_memory);
+    }
+    path_regions_free(finder);
+    memset(finder, 0, sizeof(*finder));
+}
+
+// lower f first, ties go to the deeper node
+static inline int path_node_less(Path_Node *a, Path_Node *b) {
+    return a->f < b->f || (a->f == b->f && a->g > b->g);
+}
+
+static void path_heap_up(Path_Finder *finder, uint32_t i) {
+    uint32_t node = finder->heap[i];
+    while(i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if(!path_node_less(&finder->nodes[node], &finder->nodes[finder->heap[parent]])) {
+            break;
+        }
+        finder->heap[i] = finder->heap[parent];
+        finder->nodes[finder->heap[i]].heap_index = i;
+        i = parent;
+    }
+    finder->heap[i] = node;
+    finder->nodes[node].heap_index = i;
+}
+
+static uint32_t path_heap_pop(Path_Finder *finder) {
+    uint32_t top = finder->heap[0];
+    uint32_t last = finder->heap[--finder->heap_count];
+    uint32_t i = 0;
+    for(;;) {
+        uint32_t child = 2 * i + 1;
+        if(child >= finder->heap_count) {
+            break;
+        }
+        if(child + 1 < finder->heap_count && path_node_less(&finder->nodes[finder->heap[child + 1]], &finder->nodes[finder->heap[child]])) {
+            child++;
+        }
+        if(!path_node_less(&finder->nodes[finder->heap[child]], &finder->nodes[last])) {
+            break;
+        }
+        finder->heap[i] = finder->heap[child];
+        finder->nodes[finder->heap[i]].heap_index = i;
+        i = child;
+    }
+    if(finder->heap_count) {
+        finder->heap[i] = last;
+        finder->nodes[last].heap_index = i;
+    }
+    finder->nodes[top].heap_index = PATH_NO_NODE;
+    return top;
+}
+
+static void path_result_push(Path_Finder *finder, uint32_t tile, int size) {
+    if(finder->result_count >= finder->result_capacity) {
+        uint32_t capacity = finder->result_capacity ? finder->result_capacity * 2 : 256;
+        Sys_Memory memory = sys_alloc(sizeof(Path_Point) * capacity, 0);
+        if(finder->result_count) {
+            memcpy(memory.ptr, finder->result, sizeof(Path_Point) * finder->result_count);
+        }
+        if(finder->result_memory.ptr) {
+            sys_free(finder->result_memory);
+        }
+        finder->result_memory = memory;
+        finder->result = (Path_Point *)memory.ptr;
+        finder->result_capacity = capacity;
+    }
+    Path_Point p;
+    p.x = (uint16_t)(tile % (uint32_t)size);
+    p.y = (uint16_t)(tile / (uint32_t)size);
+    finder->result[finder->result_count++] = p;
+}
+
+// keeps the corners of the path from node back to the start, in walking order
+static void path_build_result(Path_Finder *finder, uint32_t node, int size) {
+    finder->result_count = 0;
+    int last_dx = 0;
+    int last_dy = 0;
+    while(finder->nodes[node].parent != PATH_NO_NODE) {
+        uint32_t tile = finder->nodes[node].tile;
+        uint32_t parent_tile = finder->nodes[finder->nodes[node].parent].tile;
+        int dx = (int)(tile % (uint32_t)size) - (int)(parent_tile % (uint32_t)size);
+        int dy = (int)(tile / (uint32_t)size) - (int)(parent_tile / (uint32_t)size);
+        if(finder->result_count == 0 || dx != last_dx || dy != last_dy) {
+            path_result_push(finder, tile, size);
+        }
+        last_dx = dx;
+        last_dy = dy;
+        node = finder->nodes[node].parent;
+    }
+    // the corners were pushed goal first, each one where its run toward the goal ends
+    for(uint32_t i = 0, j = finder->result_count ? finder->result_count - 1 : 0; i < j; i++, j--) {
+        Path_Point t = finder->result[i];
+        finder->result[i] = finder->result[j];
+        finder->result[j] = t;
+    }
+}
+
+// NOTE: a search id of 0 would match the freshly zeroed table
+static void path_search_begin(Path_Finder *finder) {
+    if(++finder->search == 0) {
+        memset(finder->table, 0, sizeof(Path_Table_Entry) * finder->capacity * 2);
+        finder->search = 1;
+    }
+    finder->node_count = 0;
+    finder->heap_count = 0;
+}
+
+// adds key to the open set or lowers its cost, keys are tiles for path_find
+// and graph nodes for the hierarchical search
+static void path_search_open(Path_Finder *finder, uint32_t key, uint32_t parent, float g, float h) {
+    uint32_t n = path_table_find(finder, key);
+    if(n == PATH_NO_NODE) {
+        if(finder->node_count >= PATH_MAX_NODES) {
+            return;
+        }
+        if(finder->node_count >= finder->capacity) {
+            path_finder_reserve(finder, finder->capacity * 2);
+        }
+        n = finder->node_count++;
+        Path_Node *node = &finder->nodes[n];
+        node->tile = key;
+        node->parent = parent;
+        node->g = g;
+        node->f = g + h;
+        path_table_insert(finder, key, n);
+        finder->heap[finder->heap_count] = n;
+        path_heap_up(finder, finder->heap_count++);
+    } else if(finder->nodes[n].heap_index != PATH_NO_NODE && g < finder->nodes[n].g) {
+        Path_Node *node = &finder->nodes[n];
+        node->f -= node->g - g;
+        node->g = g;
+        node->parent = parent;
+        path_heap_up(finder, node->heap_index);
+    }
+}
+
+// A* inside the box [x0, x1] x [y0, y1], see path_find
+static uint32_t path_search(Path_Finder *finder, Map *map, int start_x, int start_y, int goal_x, int goal_y, int flags,
+                            int x0, int y0, int x1, int y1) {
+    int size = map->size;
+
+    finder->result_count = 0;
+    if(!map_in_bounds(map, start_x, start_y) || !map_in_bounds(map, goal_x, goal_y)) {
+        return 0;
+    }
+
+    path_search_begin(finder);
+    uint32_t goal_tile = (uint32_t)(goal_y * size + goal_x);
+    path_search_open(finder, (uint32_t)(start_y * size + start_x), PATH_NO_NODE, 0.0f,
+                     path_heuristic(start_x, start_y, goal_x, goal_y));
+
+    uint32_t best = 0;
+    float best_h = finder->nodes[0].f;
+    while(finder->heap_count) {
+        uint32_t current = path_heap_pop(finder);
+        finder->expanded++;
+        uint32_t tile = finder->nodes[current].tile;
+        if(tile == goal_tile) {
+            best = current;
+            break;
+        }
+        int x = (int)(tile % (uint32_t)size);
+        int y = (int)(tile / (uint32_t)size);
+        float h = finder->nodes[current].f - finder->nodes[current].g;
+        if(h < best_h) {
+            best_h = h;
+            best = current;
+        }
+
+        int open[4];
+        for(int d = 0; d < 8; d++) {
+            int nx = x + path_dirs[d][0];
+            int ny = y + path_dirs[d][1];
+            int inside = nx >= x0 && ny >= y0 && nx <= x1 && ny <= y1;
+            float cost = 1.0f;
+            if(d < 4) {
+                open[d] = inside && map_walkable_touch(map, nx, ny, flags);
+                if(!open[d]) {
+                    continue;
+                }
+            } else {
+                // diagonals need both sides free, units are a tile wide
+                int side_x = path_dirs[d][0] > 0 ? open[0] : open[1];
+                int side_y = path_dirs[d][1] > 0 ? open[2] : open[3];
+                if(!side_x || !side_y || !inside || !map_walkable_touch(map, nx, ny, flags)) {
+                    continue;
+                }
+                cost = PATH_DIAGONAL_COST;
+            }
+
+            path_search_open(finder, (uint32_t)(ny * size + nx), current, finder->nodes[current].g + cost,
+                             path_heuristic(nx, ny, goal_x, goal_y));
+        }
+    }
+
+    path_build_result(finder, best, size);
+    return finder->result_count;
+}
+
+// flood fills the walkable tiles of chunk c, 4 way is enough since a
+// diagonal step needs both sides free anyway
+static void path_regions_label(Path_Regions *regions, Map *map, int c, int flags) {
+    enum { CELLS = MAP_CHUNK_SIZE * MAP_CHUNK_SIZE, UNLABELLED = 0xFFFE };
+    uint16_t *label = regions->label + (size_t)c * CELLS;
+    uint16_t stack[CELLS];
+    Map_Chunk *chunk = map->chunk[c];
+
+    for(int y = 0; y < MAP_CHUNK_SIZE; y++) {
+        for(int x = 0; x < MAP_CHUNK_SIZE; x++) {
+            int type = chunk ? chunk->tile[x][y].type : map_default_tile.type;
+            label[y * MAP_CHUNK_SIZE + x] = tile_walkable(type, flags) ? UNLABELLED : PATH_NO_REGION;
+        }
+    }
+
+    uint16_t count = 0;
+    for(int cell = 0; cell < CELLS; cell++) {
+        if(label[cell] != UNLABELLED) {
+            continue;
+        }
+        int top = 0;
+        label[cell] = count;
+        stack[top++] = (uint16_t)cell;
+        while(top) {
+            int current = stack[--top];
+            int x = current % MAP_CHUNK_SIZE;
+            int y = current / MAP_CHUNK_SIZE;
+            for(int d = 0; d < 4; d++) {
+                int nx = x + path_dirs[d][0];
+                int ny = y + path_dirs[d][1];
+                if(nx < 0 || ny < 0 || nx >= MAP_CHUNK_SIZE || ny >= MAP_CHUNK_SIZE) {
+                    continue;
+                }
+                int n = ny * MAP_CHUNK_SIZE + nx;
+                if(label[n] == UNLABELLED) {
+                    label[n] = count;
+                    stack[top++] = (uint16_t)n;
+                }
+            }
+        }
+        count++;
+    }
+    regions->label_count[c] = count;
+}
+
+static inline uint32_t path_regions_root(uint32_t *region, uint32_t id) {
+    while(region[id] != id) {
+        region[id] = region[region[id]];
+        id = region[id];
+    }
+    return id;
+}
+
+static void path_regions_join(Path_Regions *regions, uint32_t a, uint32_t b) {
+    a = path_regions_root(regions->region, a);
+    b = path_regions_root(regions->region, b);
+    if(a < b) {
+        regions->region[b] = a;
+    } else if(b < a) {
+        regions->region[a] = b;
+    }
+}
+
+// joins the labels along side d (a path_dirs index) of chunk c to the
+// frontier past it, where the tile across is walkable too
+static void path_regions_join_frontier(Path_Regions *regions, Map *map, int c, int d) {
+    const uint16_t *label = regions->label + (size_t)c * MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+    int x0 = (c % map->chunk_count) * MAP_CHUNK_SIZE;
+    int y0 = (c / map->chunk_count) * MAP_CHUNK_SIZE;
+    for(int k = 0; k < MAP_CHUNK_SIZE; k++) {
+        int x = path_dirs[d][0] ? (path_dirs[d][0] > 0 ? MAP_CHUNK_SIZE - 1 : 0) : k;
+        int y = path_dirs[d][1] ? (path_dirs[d][1] > 0 ? MAP_CHUNK_SIZE - 1 : 0) : k;
+        uint16_t a = label[y * MAP_CHUNK_SIZE + x];
+        if(a != PATH_NO_REGION && map_walkable(map, x0 + x + path_dirs[d][0], y0 + y + path_dirs[d][1], regions->flags)) {
+            path_regions_join(regions, regions->first[c] + a, regions->frontier);
+        }
+    }
+}
+
+// the regions for flags, relabelling the chunks that changed since last time
+static Path_Regions *path_regions_update(Path_Finder *finder, Map *map, int flags) {
+    enum { CELLS = MAP_CHUNK_SIZE * MAP_CHUNK_SIZE };
+    Path_Regions *regions = &finder->regions[flags & PATH_SWIM];
+    if(regions->built && regions->map_version == map->version && regions->chunks_labelled == map->chunks_allocated) {
+        return regions;
+    }
+
+    int chunks = map->chunk_count * map->chunk_count;
+    if(!regions->memory.ptr) {
+        // NOTE: the labels are only written, and so only committed, for carved chunks
+        size_t label_size = sizeof(uint16_t) * CELLS * (size_t)chunks;
+        size_t count_size = sizeof(uint16_t) * (size_t)chunks;
+        regions->memory = sys_alloc(label_size + count_size + sizeof(uint32_t) * 2 * (size_t)chunks, 0);
+        regions->label = (uint16_t *)regions->memory.ptr;
+        regions->label_count = (uint16_t *)((unsigned char *)regions->memory.ptr + label_size);
+        regions->chunk_version = (uint32_t *)((unsigned char *)regions->label_count + count_size);
+        regions->first = regions->chunk_version + chunks;
+        memset(regions->label_count, 0, count_size);
+        memset(regions->chunk_version, 0, sizeof(uint32_t) * (size_t)chunks);
+        regions->flags = flags & PATH_SWIM;
+    }
+
+    int changed = 0;
+    for(int c = 0; c < chunks; c++) {
+        uint32_t version = map->chunk[c] ? map->chunk[c]->version + 1 : 0;
+        if(regions->chunk_version[c] != version) {
+            if(version) {
+                path_regions_label(regions, map, c, flags);
+            } else {
+                regions->label_count[c] = 0;
+            }
+            regions->chunk_version[c] = version;
+            changed = 1;
+        }
+    }
+    regions->built = 1;
+    regions->map_version = map->version;
+    regions->chunks_labelled = map->chunks_allocated;
+    if(!changed) {
+        return regions;
+    }
+
+    uint32_t ids = 0;
+    for(int c = 0; c < chunks; c++) {
+        regions->first[c] = ids;
+        ids += regions->label_count[c];
+    }
+    regions->frontier = ids++;
+    if(ids > regions->region_capacity) {
+        if(regions->region_memory.ptr) {
+            sys_free(regions->region_memory);
+        }
+        regions->region_capacity = ids + ids / 2;
+        regions->region_memory = sys_alloc(sizeof(uint32_t) * regions->region_capacity, 0);
+        regions->region = (uint32_t *)regions->region_memory.ptr;
+    }
+    for(uint32_t id = 0; id < ids; id++) {
+        regions->region[id] = id;
+    }
+
+    // join across the right and bottom border of every chunk
+    for(int cy = 0; cy < map->chunk_count; cy++) {
+        for(int cx = 0; cx < map->chunk_count; cx++) {
+            int c = cy * map->chunk_count + cx;
+            uint16_t *label = regions->label + (size_t)c * CELLS;
+            int labelled = regions->chunk_version[c] != 0;
+            if(cx + 1 < map->chunk_count) {
+                int right_labelled = regions->chunk_version[c + 1] != 0;
+                if(labelled && right_labelled) {
+                    uint16_t *right = label + CELLS;
+                    for(int y = 0; y < MAP_CHUNK_SIZE; y++) {
+                        uint16_t a = label[y * MAP_CHUNK_SIZE + MAP_CHUNK_SIZE - 1];
+                        uint16_t b = right[y * MAP_CHUNK_SIZE];
+                        if(a != PATH_NO_REGION && b != PATH_NO_REGION) {
+                            path_regions_join(regions, regions->first[c] + a, regions->first[c + 1] + b);
+                        }
+                    }
+                } else if(labelled) {
+                    path_regions_join_frontier(regions, map, c, 0); // right
+                } else if(right_labelled) {
+                    path_regions_join_frontier(regions, map, c + 1, 1); // left
+                }
+            }
+            if(cy + 1 < map->chunk_count) {
+                int below_labelled = regions->chunk_version[c + map->chunk_count] != 0;
+                if(labelled && below_labelled) {
+                    uint16_t *below = label + (size_t)map->chunk_count * CELLS;
+                    for(int x = 0; x < MAP_CHUNK_SIZE; x++) {
+                        uint16_t a = label[(MAP_CHUNK_SIZE - 1) * MAP_CHUNK_SIZE + x];
+                        uint16_t b = below[x];
+                        if(a != PATH_NO_REGION && b != PATH_NO_REGION) {
+                            path_regions_join(regions, regions->first[c] + a, regions->first[c + map->chunk_count] + b);
+                        }
+                    }
+                } else if(labelled) {
+                    path_regions_join_frontier(regions, map, c, 2); // down
+                } else if(below_labelled) {
+                    path_regions_join_frontier(regions, map, c + map->chunk_count, 3); // up
+                }
+            }
+        }
+    }
+    // flattened so a lookup is a single read
+    for(uint32_t id = 0; id < ids; id++) {
+        regions->region[id] = regions->region[regions->region[id]];
+    }
+    return regions;
+}
+
+// PATH_NO_NODE for blocked tiles and outside the map
+static inline uint32_t path_region(Path_Regions *regions, Map *map, int x, int y) {
+    if(!map_in_bounds(map, x, y)) {
+        return PATH_NO_NODE;
+    }
+    int c = (y / MAP_CHUNK_SIZE) * map->chunk_count + x / MAP_CHUNK_SIZE;
+    if(!regions->chunk_version[c]) {
+        return map_walkable(map, x, y, regions->flags) ? regions->region[regions->frontier] : PATH_NO_NODE;
+    }
+    uint16_t label = regions->label[(size_t)c * MAP_CHUNK_SIZE * MAP_CHUNK_SIZE + (y % MAP_CHUNK_SIZE) * MAP_CHUNK_SIZE + x % MAP_CHUNK_SIZE];
+    return label == PATH_NO_REGION ? PATH_NO_NODE : regions->region[regions->first[c] + label];
+}
+
+// the region a unit at (x, y) walks in, one standing on a blocked tile
+// steps off it to a free side first
+static uint32_t path_start_region(Path_Regions *regions, Map *map, int x, int y) {
+    uint32_t region = path_region(regions, map, x, y);
+    for(int d = 0; d < 4 && region == PATH_NO_NODE; d++) {
+        region = path_region(regions, map, x + path_dirs[d][0], y + path_dirs[d][1]);
+    }
+    return region;
+}
+
+// moves the goal to the closest tile of region within PATH_SNAP_RADIUS,
+// 0 when there is none
+static int path_snap_goal(Path_Regions *regions, Map *map, uint32_t region, int *goal_x, int *goal_y) {
+    if(path_region(regions, map, *goal_x, *goal_y) == region) {
+        return 1;
+    }
+    for(int r = 1; r <= PATH_SNAP_RADIUS; r++) {
+        for(int dy = -r; dy <= r; dy++) {
+            for(int dx = -r; dx <= r; dx++) {
+                if((dx == -r || dx == r || dy == -r || dy == r) && path_region(regions, map, *goal_x + dx, *goal_y + dy) == region) {
+                    *goal_x += dx;
+                    *goal_y += dy;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// fills finder->result with the corners of a path from start to goal. a
+// blocked goal or one cut off from the start moves to the closest tile the
+// start can reach within PATH_SNAP_RADIUS, failing that nothing is searched.
+// returns the number of waypoints, 0 when already there or there is no way
+uint32_t path_find(Path_Finder *finder, Map *map, int start_x, int start_y, int goal_x, int goal_y, int flags) {
+    finder->result_count = 0;
+    Path_Regions *regions = path_regions_update(finder, map, flags);
+    uint32_t region = path_start_region(regions, map, start_x, start_y);
+    if(region == PATH_NO_NODE || !path_snap_goal(regions, map, region, &goal_x, &goal_y)) {
+        return 0;
+    }
+    return path_search(finder, map, start_x, start_y, goal_x, goal_y, flags, 0, 0, map->size - 1, map->size - 1);
+}
+
+//=============================================================================
+//
+//
+//  HIERARCHICAL PATHFINDING
+//
+//
+//=============================================================================
+// NOTE: every map chunk is a cluster. walkable runs along a cluster border
+// get one or two transitions, a tile on each side, and the cost between
+// every pair of a cluster's transition tiles is precomputed. long orders
+// search that small graph and only run A* inside the clusters on the way.
+// clusters are built the first time a search touches them and rebuilt when
+// their chunk or a neighbour's changed since, so harvesting repairs the
+// graph locally.
+
+static inline uint32_t path_graph_node(int cluster, int k) {
+    return (uint32_t)cluster * PATH_CLUSTER_NODES + (uint32_t)k;
+}
+
+static void path_cluster_walkable(Map *map, int cx, int cy, uint8_t *walkable) {
+    Map_Chunk *chunk = map_chunk_touch(map, cx, cy);
+    for(int j = 0; j < MAP_CHUNK_SIZE; j++) {
+        for(int i = 0; i < MAP_CHUNK_SIZE; i++) {
+            int type = chunk ? chunk->tile[i][j].type : map_default_tile.type;
+            walkable[j * MAP_CHUNK_SIZE + i] = (uint8_t)tile_walkable(type, 0);
+        }
+    }
+}
+
+// dijkstra over one cluster from a local tile, cost is FLT_MAX where unreachable.
+// stops early once the stop cell is settled, -1 runs to the end
+static void path_cluster_dijkstra(const uint8_t *walkable, int sx, int sy, float *cost, int stop) {
+    enum { CELLS = MAP_CHUNK_SIZE * MAP_CHUNK_SIZE };
+    uint16_t heap[CELLS];
+    uint16_t heap_index[CELLS];
+    int count = 0;
+
+    for(int c = 0; c < CELLS; c++) {
+        cost[c] = FLT_MAX;
+        heap_index[c] = 0xFFFF;
+    }
+    int start = sy * MAP_CHUNK_SIZE + sx;
+    cost[start] = 0.0f;
+    heap[count] = (uint16_t)start;
+    heap_index[start] = (uint16_t)count++;
+
+    while(count) {
+        int cell = heap[0];
+        int last = heap[--count];
+        int i = 0;
+        for(;;) {
+            int child = 2 * i + 1;
+            if(child >= count) { break; }
+            if(child + 1 < count && cost[heap[child + 1]] < cost[heap[child]]) { child++; }
+            if(cost[heap[child]] >= cost[last]) { break; }
+            heap[i] = heap[child];
+            heap_index[heap[i]] = (uint16_t)i;
+            i = child;
+        }
+        if(count) {
+            heap[i] = (uint16_t)last;
+            heap_index[last] = (uint16_t)i;
+        }
+        heap_index[cell] = 0xFFFF;
+        if(cell == stop) {
+            break;
+        }
+
+        int x = cell % MAP_CHUNK_SIZE;
+        int y = cell / MAP_CHUNK_SIZE;
+        int open[4];
+        for(int d = 0; d < 8; d++) {
+            int nx = x + path_dirs[d][0];
+            int ny = y + path_dirs[d][1];
+            int inside = nx >= 0 && ny >= 0 && nx < MAP_CHUNK_SIZE && ny < MAP_CHUNK_SIZE;
+            float step = 1.0f;
+            if(d < 4) {
+                open[d] = inside && walkable[ny * MAP_CHUNK_SIZE + nx];
+                if(!open[d]) { continue; }
+            } else {
+                int side_x = path_dirs[d][0] > 0 ? open[0] : open[1];
+                int side_y = path_dirs[d][1] > 0 ? open[2] : open[3];
+                if(!side_x || !side_y || !inside || !walkable[ny * MAP_CHUNK_SIZE + nx]) { continue; }
+                step = PATH_DIAGONAL_COST;
+            }
+
+            int n = ny * MAP_CHUNK_SIZE + nx;
+            float g = cost[cell] + step;
+            if(g < cost[n]) {
+                int fresh = cost[n] == FLT_MAX;
+                cost[n] = g;
+                if(fresh) {
+                    heap[count] = (uint16_t)n;
+                    heap_index[n] = (uint16_t)count++;
+                }
+                // sift up
+                int k = heap_index[n];
+                while(k > 0) {
+                    int parent = (k - 1) / 2;
+                    if(cost[heap[parent]] <= g) { break; }
+                    heap[k] = heap[parent];
+                    heap_index[heap[k]] = (uint16_t)k;
+                    k = parent;
+                }
+                heap[k] = (uint16_t)n;
+                heap_index[n] = (uint16_t)k;
+            }
+        }
+    }
+}
+
+// appends the transition tiles on one side of the cluster. both clusters of
+// a border walk it in the same order and pick the same rows, so their
+// transitions always pair up
+static void path_cluster_transitions(Map *map, Path_Cluster *cluster, int cx, int cy, int d) {
+    int dx = path_dirs[d][0];
+    int dy = path_dirs[d][1];
+    int x0 = cx * MAP_CHUNK_SIZE + (dx > 0 ? MAP_CHUNK_SIZE - 1 : 0);
+    int y0 = cy * MAP_CHUNK_SIZE + (dy > 0 ? MAP_CHUNK_SIZE - 1 : 0);
+    int run_start = -1;
+
+    for(int i = 0; i <= MAP_CHUNK_SIZE; i++) {
+        int open = 0;
+        int x = x0 + (dx ? 0 : i);
+        int y = y0 + (dx ? i : 0);
+        if(i < MAP_CHUNK_SIZE) {
+            open = map_walkable(map, x, y, 0) && map_walkable(map, x + dx, y + dy, 0);
+        }
+        if(open && run_start < 0) {
+            run_start = i;
+        } else if(!open && run_start >= 0) {
+            int run_end = i - 1;
+            int picks[2] = { run_start + (run_end - run_start) / 2, -1 };
+            if(run_end - run_start + 1 > PATH_WIDE_ENTRANCE) {
+                picks[0] = run_start;
+                picks[1] = run_end;
+            }
+            for(int p = 0; p < 2 && picks[p] >= 0; p++) {
+                Path_Point point;
+                point.x = (uint16_t)(x0 + (dx ? 0 : picks[p]));
+                point.y = (uint16_t)(y0 + (dx ? picks[p] : 0));
+                int duplicate = 0;
+                for(int k = 0; k < cluster->node_count; k++) {
+                    duplicate |= cluster->node[k].x == point.x && cluster->node[k].y == point.y;
+                }
+                if(!duplicate) {
+                    cluster->node[cluster->node_count++] = point;
+                }
+            }
+            run_start = -1;
+        }
+    }
+}
+
+static void path_cluster_versions(Map *map, int cx, int cy, uint32_t versions[5]) {
+    versions[0] = map_chunk_version(map, cx, cy);
+    for(int d = 0; d < 4; d++) {
+        int nx = cx + path_dirs[d][0];
+        int ny = cy + path_dirs[d][1];
+        int inside = nx >= 0 && ny >= 0 && nx < map->chunk_count && ny < map->chunk_count;
+        versions[d + 1] = inside ? map_chunk_version(map, nx, ny) : 0;
+    }
+}
+
+static void path_cluster_build(Path_Graph *graph, Map *map, Path_Cluster *cluster, int cx, int cy) {
+    float cost[MAP_CHUNK_SIZE * MAP_CHUNK_SIZE];
+    path_cluster_walkable(map, cx, cy, cluster->walkable);
+
+    cluster->node_count = 0;
+    for(int d = 0; d < 4; d++) {
+        path_cluster_transitions(map, cluster, cx, cy, d);
+    }
+
+    int x0 = cx * MAP_CHUNK_SIZE;
+    int y0 = cy * MAP_CHUNK_SIZE;
+    for(int k = 0; k < cluster->node_count; k++) {
+        path_cluster_dijkstra(cluster->walkable, cluster->node[k].x - x0, cluster->node[k].y - y0, cost, -1);
+        for(int j = 0; j < cluster->node_count; j++) {
+            float c = cost[(cluster->node[j].y - y0) * MAP_CHUNK_SIZE + (cluster->node[j].x - x0)];
+            cluster->dist[k][j] = c == FLT_MAX ? PATH_NO_EDGE : (uint16_t)(c * PATH_COST_SCALE + 0.5f);
+        }
+    }
+
+    path_cluster_versions(map, cx, cy, cluster->versions);
+    cluster->built = 1;
+    graph->clusters_built++;
+}
+
+void path_graph_init(Path_Graph *graph, Map *map) {
+    memset(graph, 0, sizeof(*graph));
+    graph->cluster_count = map->chunk_count;
+    size_t count = (size_t)map->chunk_count * (size_t)map->chunk_count;
+    graph->table_memory = sys_alloc(sizeof(Path_Cluster *) * count, 0);
+    graph->cluster = (Path_Cluster **)graph->table_memory.ptr;
+    memset(graph->cluster, 0, sizeof(Path_Cluster *) * count);
+    path_finder_init(&graph->search);
+}
+
+void path_graph_free(Path_Graph *graph) {
+    Map_Block *block = graph->blocks;
+    while(block) {
+        Map_Block *next = block->next;
+        sys_free(block->memory);
+        block = next;
+    }
+    if(graph->table_memory.ptr) {
+        sys_free(graph->table_memory);
+    }
+    if(graph->result_memory.ptr) {
+        sys_free(graph->result_memory);
+    }
+    path_finder_free(&graph->search);
+    memset(graph, 0, sizeof(*graph));
+}
+
+// the cluster, built and current with the map
+static Path_Cluster *path_graph_cluster(Path_Graph *graph, Map *map, int c) {
+    Path_Cluster *cluster = graph->cluster[c];
+    int cx = c % graph->cluster_count;
+    int cy = c / graph->cluster_count;
+
+    if(!cluster) {
+        if(!graph->block_free) {
+            Sys_Memory memory = sys_alloc(sizeof(Map_Block) + sizeof(Path_Cluster) * PATH_CLUSTERS_PER_BLOCK, 0);
+            Map_Block *block = (Map_Block *)memory.ptr;
+            block->memory = memory;
+            block->next = graph->blocks;
+            graph->blocks = block;
+            graph->block_next = (Path_Cluster *)(block + 1);
+            graph->block_free = PATH_CLUSTERS_PER_BLOCK;
+        }
+        cluster = graph->block_next++;
+        graph->block_free--;
+        cluster->built = 0;
+        graph->cluster[c] = cluster;
+    }
+
+    if(cluster->built) {
+        uint32_t versions[5];
+        path_cluster_versions(map, cx, cy, versions);
+        if(memcmp(versions, cluster->versions, sizeof(versions)) != 0) {
+            cluster->built = 0;
+        }
+    }
+    if(!cluster->built) {
+        path_cluster_build(graph, map, cluster, cx, cy);
+    }
+    return cluster;
+}
+
+static inline Path_Point path_graph_point(Path_Graph *graph, uint32_t node) {
+    return graph->cluster[node / PATH_CLUSTER_NODES]->node[node % PATH_CLUSTER_NODES];
+}
+
+static void path_graph_result_push(Path_Graph *graph, Path_Point p) {
+    if(graph->result_count >= graph->result_capacity) {
+        uint32_t capacity = graph->result_capacity ? graph->result_capacity * 2 : 256;
+        Sys_Memory memory = sys_alloc(sizeof(Path_Point) * capacity, 0);
+        if(graph->result_count) {
+            memcpy(memory.ptr, graph->result, sizeof(Path_Point) * graph->result_count);
+        }
+        if(graph->result_memory.ptr) {
+            sys_free(graph->result_memory);
+        }
+        graph->result_memory = memory;
+        graph->result = (Path_Point *)memory.ptr;
+        graph->result_capacity = capacity;
+    }
+    graph->result[graph->result_count++] = p;
+}
+
+static inline int path_same_cluster(Path_Point a, Path_Point b) {
+    return a.x / MAP_CHUNK_SIZE == b.x / MAP_CHUNK_SIZE && a.y / MAP_CHUNK_SIZE == b.y / MAP_CHUNK_SIZE;
+}
+
+// appends the corners of the next leg from the tile from along count graph
+// nodes to the graph's result: A* bounded to from's cluster up to the last
+// node in it, then the steps over the border. returns how many nodes were used
+uint32_t path_graph_refine_leg(Path_Graph *graph, Path_Finder *finder, Map *map, Path_Point from, const Path_Point *nodes, uint32_t count) {
+    uint32_t used = 0;
+    while(used < count && path_same_cluster(from, nodes[used])) {
+        Path_Point to = nodes[used++];
+        int x0 = from.x / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+        int y0 = from.y / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+        uint32_t steps = path_search(finder, map, from.x, from.y, to.x, to.y, 0,
+                                     x0, y0, x0 + MAP_CHUNK_SIZE - 1, y0 + MAP_CHUNK_SIZE - 1);
+        for(uint32_t i = 0; i < steps; i++) {
+            path_graph_result_push(graph, finder->result[i]);
+        }
+        from = to;
+    }
+    while(used < count && !path_same_cluster(from, nodes[used])) {
+        from = nodes[used++];
+        path_graph_result_push(graph, from);
+    }
+    return used;
+}
+
+// fills graph->result with the nodes of a path from start to goal through
+// the cluster graph, ending with the goal, which is snapped like path_find
+// does. path_graph_refine_leg turns them into waypoints. returns the number
+// of nodes, 0 when the start can't get near the goal, -1 when the start is
+// blocked (the caller falls back to path_find)
+int path_find_hierarchical(Path_Graph *graph, Path_Finder *finder, Map *map, int start_x, int start_y, int goal_x, int goal_y) {
+    graph->result_count = 0;
+    if(!map_walkable(map, start_x, start_y, 0)) {
+        return -1;
+    }
+    Path_Regions *regions = path_regions_update(finder, map, 0);
+    if(!path_snap_goal(regions, map, path_region(regions, map, start_x, start_y), &goal_x, &goal_y)) {
+        return 0;
+    }
+
+    float cost[MAP_CHUNK_SIZE * MAP_CHUNK_SIZE];
+    float goal_dist[PATH_CLUSTER_NODES];
+    int start_cluster = (start_y / MAP_CHUNK_SIZE) * graph->cluster_count + start_x / MAP_CHUNK_SIZE;
+    int goal_cluster = (goal_y / MAP_CHUNK_SIZE) * graph->cluster_count + goal_x / MAP_CHUNK_SIZE;
+    Path_Cluster *start = path_graph_cluster(graph, map, start_cluster);
+    Path_Cluster *goal = path_graph_cluster(graph, map, goal_cluster);
+    Path_Finder *search = &graph->search;
+    path_search_begin(search);
+
+    // the goal is a node of its own, only reachable from its cluster's transitions
+    int gx0 = goal_x / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+    int gy0 = goal_y / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+    path_cluster_dijkstra(goal->walkable, goal_x - gx0, goal_y - gy0, cost, -1);
+    for(int k = 0; k < goal->node_count; k++) {
+        goal_dist[k] = cost[(goal->node[k].y - gy0) * MAP_CHUNK_SIZE + (goal->node[k].x - gx0)];
+    }
+
+    int sx0 = start_x / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+    int sy0 = start_y / MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+    path_cluster_dijkstra(start->walkable, start_x - sx0, start_y - sy0, cost, -1);
+    for(int k = 0; k < start->node_count; k++) {
+        float g = cost[(start->node[k].y - sy0) * MAP_CHUNK_SIZE + (start->node[k].x - sx0)];
+        if(g != FLT_MAX) {
+            path_search_open(search, path_graph_node(start_cluster, k), PATH_NO_NODE, g,
+                             path_heuristic(start->node[k].x, start->node[k].y, goal_x, goal_y));
+        }
+    }
+
+    uint32_t found = PATH_NO_NODE;
+    while(search->heap_count) {
+        uint32_t current = path_heap_pop(search);
+        search->expanded++;
+        uint32_t key = search->nodes[current].tile;
+        if(key == PATH_GRAPH_GOAL) {
+            found = current;
+            break;
+        }
+
+        int c = (int)(key / PATH_CLUSTER_NODES);
+        int k = (int)(key % PATH_CLUSTER_NODES);
+        Path_Cluster *cluster = graph->cluster[c];
+        Path_Point p = cluster->node[k];
+        float g = search->nodes[current].g;
+
+        if(c == goal_cluster && goal_dist[k] != FLT_MAX) {
+            path_search_open(search, PATH_GRAPH_GOAL, current, g + goal_dist[k], 0.0f);
+        }
+        for(int j = 0; j < cluster->node_count; j++) {
+            if(j != k && cluster->dist[k][j] != PATH_NO_EDGE) {
+                path_search_open(search, path_graph_node(c, j), current, g + cluster->dist[k][j] / PATH_COST_SCALE,
+                                 path_heuristic(cluster->node[j].x, cluster->node[j].y, goal_x, goal_y));
+            }
+        }
+        // a transition tile steps straight over the border to its partner
+        for(int d = 0; d < 4; d++) {
+            int nx = p.x + path_dirs[d][0];
+            int ny = p.y + path_dirs[d][1];
+            if(!map_in_bounds(map, nx, ny) || nx / MAP_CHUNK_SIZE + (ny / MAP_CHUNK_SIZE) * graph->cluster_count == c) {
+                continue;
+            }
+            int nc = (ny / MAP_CHUNK_SIZE) * graph->cluster_count + nx / MAP_CHUNK_SIZE;
+            Path_Cluster *neighbour = path_graph_cluster(graph, map, nc);
+            for(int j = 0; j < neighbour->node_count; j++) {
+                if(neighbour->node[j].x == nx && neighbour->node[j].y == ny) {
+                    path_search_open(search, path_graph_node(nc, j), current, g + 1.0f,
+                                     path_heuristic(nx, ny, goal_x, goal_y));
+                    break;
+                }
+            }
+        }
+    }
+    if(found == PATH_NO_NODE) {
+        return -1;
+    }
+
+    // the open set is done with, its array holds the graph path goal first
+    uint32_t legs = 0;
+    for(uint32_t n = search->nodes[found].parent; n != PATH_NO_NODE; n = search->nodes[n].parent) {
+        search->heap[legs++] = search->nodes[n].tile;
+    }
+    for(uint32_t leg = legs; leg > 0; leg--) {
+        path_graph_result_push(graph, path_graph_point(graph, search->heap[leg - 1]));
+    }
+    Path_Point goal_point;
+    goal_point.x = (uint16_t)goal_x;
+    goal_point.y = (uint16_t)goal_y;
+    path_graph_result_push(graph, goal_point);
+    return (int)graph->result_count;
+}
+
+// NOTE: refining a whole long path up front costs most of an order, and
+// the map may change before the unit gets far. orders only refine the
+// first leg, a unit that walked it waits in army_path_advance and the
+// main thread refines the next one between steps.
+
+// replaces the graph nodes at the front of the unit's unwalked path with the
+// waypoints of the next leg from the tile it stands on
+void army_path_refine(Game_State *state, Army *army, int i) {
+    Path_Graph *graph = &state->path_graph;
+    Path_Point from;
+    from.x = (uint16_t)unit_tile_coord(army->x[i]);
+    from.y = (uint16_t)unit_tile_coord(army->y[i]);
+    const Path_Point *nodes = army->path_points + army->path_start[i] + army->path_next[i];
+    uint32_t count = army->path_count[i] - army->path_next[i];
+
+    graph->result_count = 0;
+    uint32_t used = path_graph_refine_leg(graph, &state->path_finder, &state->map, from, nodes, count);
+    uint32_t refined = graph->result_count;
+    for(uint32_t n = used; n < count; n++) {
+        path_graph_result_push(graph, nodes[n]);
+    }
+    army_path_set(army, i, graph->result, graph->result_count);
+    army->path_refined[i] = refined;
+}
+
+// sends unit i of army along a path to the tile the point (x, y) is drawn over,
+// long walks go through the cluster graph
+void army_order_move(Game_State *state, Army *army, int i, float x, float y) {
+    int flags = (army->flags[i] & UNIT_FLAG_SWIMMING) ? PATH_SWIM : 0;
+    int sx = unit_tile_coord(army->x[i]);
+    int sy = unit_tile_coord(army->y[i]);
+    int gx = unit_tile_coord(x);
+    int gy = unit_tile_coord(y);
+
+    if(!flags && path_heuristic(sx, sy, gx, gy) > PATH_GRAPH_MIN_DISTANCE) {
+        int count = path_find_hierarchical(&state->path_graph, &state->path_finder, &state->map, sx, sy, gx, gy);
+        if(count >= 0) {
+            army_path_set(army, i, state->path_graph.result, (uint32_t)count);
+            army->path_refined[i] = 0;
+            if(count) {
+                army_path_refine(state, army, i);
+            }
+            return;
+        }
+    }
+    uint32_t count = path_find(&state->path_finder, &state->map, sx, sy, gx, gy, flags);
+    army_path_set(army, i, state->path_finder.result, count);
+}
+
+//=============================================================================
+//
+//
+//  FLOW FIELDS
+//
+//
+//=============================================================================
+void flow_fields_free(Flow_Field_Set *set) {
+    for(int f = 0; f < FLOW_FIELD_MAX; f++) {
+        if(set->field[f].memory.ptr) {
+            sys_free(set->field[f].memory);
+        }
+    }
+    if(set->scratch_memory.ptr) {
+        sys_free(set->scratch_memory);
+    }
+    memset(set, 0, sizeof(*set));
+}
+
+static void flow_scratch_reserve(Flow_Field_Set *set, int cells) {
+    if(cells <= set->scratch_capacity) {
+        return;
+    }
+    size_t count = (size_t)cells;
+    if(set->scratch_memory.ptr) {
+        sys_free(set->scratch_memory);
+    }
+    set->scratch_memory = sys_alloc((sizeof(float) + (FLOW_BUCKETS + 1) * sizeof(uint32_t) + sizeof(uint8_t)) * count, 0);
+    unsigned char *p = (unsigned char *)set->scratch_memory.ptr;
+    set->cost = (float *)p;
+    p += sizeof(float) * count;
+    for(int b = 0; b < FLOW_BUCKETS; b++) {
+        set->bucket[b] = (uint32_t *)p;
+        p += sizeof(uint32_t) * count;
+    }
+    set->queued = (uint32_t *)p;
+    p += sizeof(uint32_t) * count;
+    set->walkable = p;
+    set->scratch_capacity = cells;
+}
+
+// queues the cell in the bucket of its cost, once per bucket
+static inline void flow_queue(Flow_Field_Set *set, uint32_t cell) {
+    uint32_t b = (uint32_t)set->cost[cell];
+    if(set->queued[cell] != b) {
+        set->queued[cell] = b;
+        set->bucket[b % FLOW_BUCKETS][set->bucket_count[b % FLOW_BUCKETS]++] = cell;
+    }
+}
+
+// dijkstra out from the goal over the region, every tile points at the
+// neighbour it was reached from. same moves and costs as path_find
+static void flow_field_clear(Flow_Field_Set *set, Flow_Field *field, Map *map) {
+    int width = field->width;
+    int cells = width * field->height;
+    flow_scratch_reserve(set, cells);
+    for(int b = 0; b < FLOW_BUCKETS; b++) {
+        set->bucket_count[b] = 0;
+    }
+    for(int c = 0; c < cells; c++) {
+        set->cost[c] = 1e30f;
+    }
+    memset(set->queued, 0xFF, sizeof(uint32_t) * (size_t)cells); // PATH_NO_NODE
+    memset(field->dir, FLOW_NONE, (size_t)cells);
+
+    // a chunk at a time, chunks store their tiles column first
+    int x1 = field->x0 + width;
+    int y1 = field->y0 + field->height;
+    for(int cy = field->y0 / MAP_CHUNK_SIZE; cy * MAP_CHUNK_SIZE < y1; cy++) {
+        for(int cx = field->x0 / MAP_CHUNK_SIZE; cx * MAP_CHUNK_SIZE < x1; cx++) {
+            Map_Chunk *chunk = map_chunk_touch(map, cx, cy);
+            int left = cx * MAP_CHUNK_SIZE > field->x0 ? cx * MAP_CHUNK_SIZE : field->x0;
+            int top = cy * MAP_CHUNK_SIZE > field->y0 ? cy * MAP_CHUNK_SIZE : field->y0;
+            int right = (cx + 1) * MAP_CHUNK_SIZE < x1 ? (cx + 1) * MAP_CHUNK_SIZE : x1;
+            int bottom = (cy + 1) * MAP_CHUNK_SIZE < y1 ? (cy + 1) * MAP_CHUNK_SIZE : y1;
+            for(int x = left; x < right; x++) {
+                for(int y = top; y < bottom; y++) {
+                    int type = chunk ? chunk->tile[x % MAP_CHUNK_SIZE][y % MAP_CHUNK_SIZE].type : map_default_tile.type;
+                    set->walkable[(y - field->y0) * width + (x - field->x0)] = (uint8_t)tile_walkable(type, 0);
+                }
+            }
+        }
+    }
+}
+
+// adds a target tile, any number can be seeded before integrating. returns 0
+// for tiles outside the field or unwalkable ones
+static int flow_field_seed(Flow_Field_Set *set, Flow_Field *field, int x, int y) {
+    x -= field->x0;
+    y -= field->y0;
+    if(x < 0 || y < 0 || x >= field->width || y >= field->height) {
+        return 0;
+    }
+    uint32_t goal = (uint32_t)(y * field->width + x);
+    if(!set->walkable[goal] || set->cost[goal] == 0.0f) {
+        return set->walkable[goal];
+    }
+    set->cost[goal] = 0.0f;
+    flow_queue(set, goal);
+    return 1;
+}
+
+// NOTE: steps cost at least 1, so nothing in the bucket being worked on can
+// still lower another cell of it. every cell comes out of its bucket final
+// and a bucket needs no order, unlike the heap path_find keeps. with wanted
+// cells marked it stops FLOW_CHASE_SLACK past the last of them, the tiles
+// left over keep the step they were last reached with or FLOW_NONE
+static void flow_field_integrate(Flow_Field_Set *set, Flow_Field *field, uint32_t wanted) {
+    int width = field->width;
+    float limit = 1e30f;
+
+    for(uint32_t b = 0; (float)b <= limit; b++) {
+        uint32_t *bucket = set->bucket[b % FLOW_BUCKETS];
+        uint32_t *count = &set->bucket_count[b % FLOW_BUCKETS];
+        if(!*count && !set->bucket_count[(b + 1) % FLOW_BUCKETS] && !set->bucket_count[(b + 2) % FLOW_BUCKETS]) {
+            break;
+        }
+
+        // steps only reach the next two buckets, this one doesn't grow
+        for(uint32_t k = 0; k < *count; k++) {
+            uint32_t cell = bucket[k];
+            if(set->queued[cell] != b) {
+                continue; // moved to an earlier bucket since
+            }
+            set->queued[cell] = PATH_NO_NODE;
+            if((set->walkable[cell] & FLOW_WANTED) && --wanted == 0) {
+                limit = set->cost[cell] + FLOW_CHASE_SLACK;
+            }
+
+            int x = (int)cell % width;
+            int y = (int)cell / width;
+            int open[4];
+            for(int d = 0; d < 8; d++) {
+                int nx = x + path_dirs[d][0];
+                int ny = y + path_dirs[d][1];
+                int inside = nx >= 0 && ny >= 0 && nx < width && ny < field->height;
+                float step = 1.0f;
+                if(d < 4) {
+                    open[d] = inside && set->walkable[ny * width + nx];
+                    if(!open[d]) {
+                        continue;
+                    }
+                } else {
+                    int side_x = path_dirs[d][0] > 0 ? open[0] : open[1];
+                    int side_y = path_dirs[d][1] > 0 ? open[2] : open[3];
+                    if(!side_x || !side_y || !inside || !set->walkable[ny * width + nx]) {
+                        continue;
+                    }
+                    step = PATH_DIAGONAL_COST;
+                }
+
+                uint32_t n = (uint32_t)(ny * width + nx);
+                float cost = set->cost[cell] + step;
+                if(cost < set->cost[n]) {
+                    set->cost[n] = cost;
+                    // the step back is the opposite direction, see path_dirs
+                    field->dir[n] = (uint8_t)(d ^ 1);
+                    flow_queue(set, n);
+                }
+            }
+        }
+        *count = 0;
+    }
+}
+
+// the oldest slot that no unit of army follows. when every field is followed
+// the units on the oldest one stop
+static int flow_field_slot(Flow_Field_Set *set, Army *army) {
+    int used[FLOW_FIELD_MAX] = { 0 };
+    for(int i = 0; i < army->count; i++) {
+        if(army->flags[i] & UNIT_FLAG_FLOW) {
+            used[army->flow[i]] = 1;
+        }
+    }
+    int slot = -1;
+    for(int f = 0; f < FLOW_FIELD_MAX; f++) {
+        if(!used[f] && (slot < 0 || set->field[f].built < set->field[slot].built)) {
+            slot = f;
+        }
+    }
+    if(slot < 0) {
+        slot = 0;
+        for(int f = 1; f < FLOW_FIELD_MAX; f++) {
+            if(set->field[f].built < set->field[slot].built) {
+                slot = f;
+            }
+        }
+        for(int i = 0; i < army->count; i++) {
+            if((army->flags[i] & UNIT_FLAG_FLOW) && army->flow[i] == (uint32_t)slot) {
+                army_path_clear(army, i);
+            }
+        }
+    }
+    return slot;
+}
+
+// sizes the field to the box plus FLOW_FIELD_MARGIN, clipped to the map
+static void flow_field_region(Flow_Field_Set *set, Flow_Field *field, Map *map, int left, int top, int right, int bottom) {
+    left -= FLOW_FIELD_MARGIN;
+    top -= FLOW_FIELD_MARGIN;
+    right += FLOW_FIELD_MARGIN;
+    bottom += FLOW_FIELD_MARGIN;
+    field->x0 = left < 0 ? 0 : left;
+    field->y0 = top < 0 ? 0 : top;
+    field->width = (right >= map->size ? map->size - 1 : right) - field->x0 + 1;
+    field->height = (bottom >= map->size ? map->size - 1 : bottom) - field->y0 + 1;
+    field->built = ++set->builds;
+
+    int cells = field->width * field->height;
+    if(cells > field->capacity) {
+        if(field->memory.ptr) {
+            sys_free(field->memory);
+        }
+        field->memory = sys_alloc((size_t)cells, 0);
+        field->dir = (uint8_t *)field->memory.ptr;
+        field->capacity = cells;
+    }
+}
+
+// builds a field toward (goal_x, goal_y) covering the box around it,
+// reusing the oldest slot that no unit of army follows. -1 when the goal
+// has no walkable tile near it
+int flow_field_build(Flow_Field_Set *set, Map *map, Army *army, int goal_x, int goal_y, int left, int top, int right, int bottom) {
+    // snap the goal to the closest walkable tile
+    int found = map_walkable(map, goal_x, goal_y, 0);
+    for(int r = 1; r <= FLOW_FIELD_MARGIN && !found; r++) {
+        for(int dy = -r; dy <= r && !found; dy++) {
+            for(int dx = -r; dx <= r && !found; dx++) {
+                if((dx == -r || dx == r || dy == -r || dy == r) && map_walkable(map, goal_x + dx, goal_y + dy, 0)) {
+                    goal_x += dx;
+                    goal_y += dy;
+                    found = 1;
+                }
+            }
+        }
+    }
+    if(!found) {
+        return -1;
+    }
+
+    int slot = flow_field_slot(set, army);
+    Flow_Field *field = &set->field[slot];
+    flow_field_region(set, field, map,
+                      left < goal_x ? left : goal_x, top < goal_y ? top : goal_y,
+                      right > goal_x ? right : goal_x, bottom > goal_y ? bottom : goal_y);
+    field->goal_x = goal_x;
+    field->goal_y = goal_y;
+
+    flow_field_clear(set, field, map);
+    flow_field_seed(set, field, goal_x, goal_y);
+    flow_field_integrate(set, field, 0);
+    return slot;
+}
+
+// grows the box by the tiles army stands on
+static void flow_army_bounds(Army *army, int *left, int *top, int *right, int *bottom) {
+    for(int i = 0; i < army->count; i++) {
+        int tx = unit_tile_coord(army->x[i]);
+        int ty = unit_tile_coord(army->y[i]);
+        *left = tx < *left ? tx : *left;
+        *top = ty < *top ? ty : *top;
+        *right = tx > *right ? tx : *right;
+        *bottom = ty > *bottom ? ty : *bottom;
+    }
+}
+
+static int flow_field_seed_army(Flow_Field_Set *set, Flow_Field *field, Map *map, Army *target) {
+    flow_field_clear(set, field, map);
+    int seeded = 0;
+    for(int i = 0; i < target->count; i++) {
+        seeded += flow_field_seed(set, field, unit_tile_coord(target->x[i]), unit_tile_coord(target->y[i]));
+    }
+    return seeded;
+}
+
+// builds a field toward the closest unit of target over the box around army,
+// every unit of target in it is a goal. the box only grows to take in target
+// when none of it is close, and the integration ends just past the farthest
+// unit of army. -1 when no unit of target stands on a walkable tile
+int flow_field_build_chase(Flow_Field_Set *set, Map *map, Army *army, Army *target) {
+    int left = map->size, top = map->size, right = -1, bottom = -1;
+    flow_army_bounds(army, &left, &top, &right, &bottom);
+    if(right < 0) {
+        return -1;
+    }
+
+    int slot = flow_field_slot(set, army);
+    Flow_Field *field = &set->field[slot];
+    flow_field_region(set, field, map, left, top, right, bottom);
+    field->goal_x = -1;
+    field->goal_y = -1;
+    if(!flow_field_seed_army(set, field, map, target)) {
+        flow_army_bounds(target, &left, &top, &right, &bottom);
+        flow_field_region(set, field, map, left, top, right, bottom);
+        if(!flow_field_seed_army(set, field, map, target)) {
+            return -1;
+        }
+    }
+
+    uint32_t wanted = 0;
+    for(int i = 0; i < army->count; i++) {
+        int x = unit_tile_coord(army->x[i]) - field->x0;
+        int y = unit_tile_coord(army->y[i]) - field->y0;
+        if(x < 0 || y < 0 || x >= field->width || y >= field->height) {
+            continue;
+        }
+        uint8_t *cell = &set->walkable[y * field->width + x];
+        if(*cell == 1) {
+            *cell |= FLOW_WANTED;
+            wanted++;
+        }
+    }
+    flow_field_integrate(set, field, wanted);
+    return slot;
+}
+
+// steps toward the next tile of the unit's field, safe from the update jobs
+// since it only touches unit i
+static inline void flow_field_advance(Flow_Field_Set *set, Army *army, int i) {
+    Flow_Field *field = &set->field[army->flow[i]];
+    int x = unit_tile_coord(army->x[i]) - field->x0;
+    int y = unit_tile_coord(army->y[i]) - field->y0;
+    uint8_t d = FLOW_NONE;
+    if(x >= 0 && y >= 0 && x < field->width && y < field->height) {
+        d = field->dir[y * field->width + x];
+    }
+    if(d == FLOW_NONE) {
+        army->flags[i] &= ~UNIT_FLAG_FLOW;
+        return;
+    }
+    army->look_x[i] = (float)(field->x0 + x + path_dirs[d][0] - 1);
+    army->look_y[i] = (float)(field->y0 + y + path_dirs[d][1] - 1);
+    army->flags[i] |= UNIT_FLAG_MOVING;
+}
+
+// one field for the whole selection, small groups path each unit instead
+void selection_order_move(Game_State *state, float x, float y) {
+    Army *ally = &state->ally;
+    int live = 0;
+    int left = state->map.size, top = state->map.size, right = -1, bottom = -1;
+    for(int s = 0; s < state->selection_count; s++) {
+        int u = army_index(ally, state->selection[s]);
+        if(u < 0) { continue; }
+        int tx = unit_tile_coord(ally->x[u]);
+        int ty = unit_tile_coord(ally->y[u]);
+        left = tx < left ? tx : left;
+        top = ty < top ? ty : top;
+        right = tx > right ? tx : right;
+        bottom = ty > bottom ? ty : bottom;
+        live++;
+    }
+
+    int field = -1;
+    if(live >= FLOW_FIELD_MIN_UNITS) {
+        field = flow_field_build(&state->flow_fields, &state->map, ally, unit_tile_coord(x), unit_tile_coord(y), left, top, right, bottom);
+    }
+
+    for(int s = 0; s < state->selection_count; s++) {
+        int u = army_index(ally, state->selection[s]);
+        if(u < 0) { continue; }
+        if(field >= 0) {
+            army_path_set(ally, u, 0, 0);
+            ally->flow[u] = (uint32_t)field;
+            ally->flags[u] |= UNIT_FLAG_FLOW;
+        } else {
+            army_order_move(state, ally, u, x, y);
+        }
+    }
+}
+
+//=============================================================================
+//
+//
+//  SNAPSHOTS
+//
+//
+//=============================================================================
+// NOTE: a snapshot is a header and then the live part of the state back to
+// back: the game scalars, the chunk table and every carved chunk, both
+// armies and the flow fields units follow. pointers become indices on the
+// way out, chunk table entries index the chunk array and the selection holds
+// column indices. chunks that were never carved come back from the seed.
+// the cell lists go out as slots in link order so a loaded game walks its
+// cells the way the saved one did. the path graph and search scratch are caches, they are rebuilt as
+// searches touch them. loading maps the chunk array copy on write and uses
+// it in place, the pages are only read once something touches them.
+// everything is loaded next to the running game and checked before it
+// replaces anything, a bad file never leaves a half loaded state behind.
+#define SNAPSHOT_MAGIC 0x5053444c // "LDSP"
+#define SNAPSHOT_VERSION 6
+#define SNAPSHOT_NO_CHUNK 0xFFFFFFFF
+#define SNAPSHOT_MAX_CAPACITY (1 << 26) // units or waypoints a header may ask memory for
+
+typedef struct Snapshot_Header {
+    uint32_t magic;
+    uint32_t version;
+    // layout the file was written with, loading refuses anything else
+    uint32_t map_size;
+    uint32_t chunk_size; // bytes per Map_Chunk
+    uint32_t cooldowns;
+    uint32_t flow_fields;
+    uint32_t chunk_count; // carved chunks
+    uint32_t pad;
+    uint64_t chunks_offset; // of the chunk array, on a cache line
+    uint64_t size; // of the whole file, a shorter one is a torn save
+} Snapshot_Header;
+
+typedef struct Snapshot_Game {
+    Vec2 mouse_released;
+    Vec2 mouse_pressed;
+    Vec2 camera;
+    uint64_t map_seed;
+    int map_generated;
+    Sys_Rand rand;
+    float resource_ticks;
+    float enemy_spawn_time;
+    int horde_field;
+    float horde_field_time;
+    float sim_accumulator;
+    float sim_alpha;
+    uint64_t tick;
+    uint64_t frame;
+    int selection_count;
+} Snapshot_Game;
+
+typedef struct Snapshot_Army {
+    int count;
+    int capacity;
+    uint32_t slot_count;
+    uint32_t free_slot;
+    uint32_t path_used;
+    uint32_t path_capacity;
+} Snapshot_Army;
+
+typedef struct Snapshot_Flow_Field {
+    int x0, y0;
+    int width, height;
+    int goal_x, goal_y;
+    uint64_t built;
+} Snapshot_Flow_Field;
+
+typedef struct Snapshot_Stream {
+    Sys_File file;
+    uint64_t offset;
+    int ok; // cleared by the first short read or write
+} Snapshot_Stream;
+
+static void snapshot_write(Snapshot_Stream *s, const void *source, uint64_t size) {
+    if(s->ok && size && sys_file_write(s->file, s->offset, size, (void *)source) != size) {
+        s->ok = 0;
+    }
+    s->offset += size;
+}
+
+static void snapshot_read(Snapshot_Stream *s, void *destination, uint64_t size) {
+    // NOTE: a read past the end fails the stream, sys_file_read would raise it as a fatal error
+    if(s->ok && size > s->file.size - (s->offset < s->file.size ? s->offset : s->file.size)) {
+        s->ok = 0;
+    }
+    if(s->ok && size && sys_file_read(s->file, s->offset, size, destination) != size) {
+        s->ok = 0;
+    }
+    s->offset += size;
+}
+
+static void snapshot_write_army(Snapshot_Stream *s, Army *army) {
+    Snapshot_Army header = { army->count, army->capacity, army->slot_count, army->free_slot, army->path_used, army->path_capacity };
+    snapshot_write(s, &header, sizeof(header));
+#define SNAPSHOT_WRITE_COLUMN(T, name) snapshot_write(s, army->name, sizeof(T) * (uint64_t)army->count);
+    ARMY_COLUMNS(SNAPSHOT_WRITE_COLUMN)
+#undef SNAPSHOT_WRITE_COLUMN
+    for(int c = 0; c < COOLDOWN_MAX; c++) {
+        snapshot_write(s, army->cooldown[c], sizeof(float) * (uint64_t)army->count);
+    }
+    snapshot_write(s, army->slot_dense, sizeof(uint32_t) * (uint64_t)army->slot_count);
+    snapshot_write(s, army->slot_generation, sizeof(uint32_t) * (uint64_t)army->slot_count);
+    snapshot_write(s, army->path_points, sizeof(Path_Point) * (uint64_t)army->path_used);
+    // NOTE: army_link pushes onto the head, so every list goes out tail first
+    for(int c = 0; c < UNIT_CELLS_PER_ROW * UNIT_CELLS_PER_ROW; c++) {
+        uint32_t slot = army->cell_head[c];
+        while(slot != ARMY_NO_SLOT && army->slot_next[slot] != ARMY_NO_SLOT) {
+            slot = army->slot_next[slot];
+        }
+        while(slot != ARMY_NO_SLOT) {
+            snapshot_write(s, &slot, sizeof(slot));
+            slot = army->slot_prev[slot];
+        }
+    }
+}
+
+// links the units back into their cells in the order they were written, 0
+// when a slot isn't live or comes up twice
+static int snapshot_read_links(Snapshot_Stream *s, Army *army) {
+    if(!army->count) {
+        return 1;
+    }
+    Sys_Memory memory = sys_alloc(sizeof(uint32_t) * (size_t)army->count, 0);
+    uint32_t *order = (uint32_t *)memory.ptr;
+    snapshot_read(s, order, sizeof(uint32_t) * (uint64_t)army->count);
+    for(int i = 0; i < army->count; i++) {
+        army->cell[i] = ARMY_NO_SLOT;
+    }
+    int ok = s->ok;
+    for(int k = 0; ok && k < army->count; k++) {
+        uint32_t slot = order[k];
+        uint32_t i = slot < army->slot_count ? army->slot_dense[slot] : ARMY_NO_SLOT;
+        if(i >= (uint32_t)army->count || army->slot[i] != slot || army->cell[i] != ARMY_NO_SLOT) {
+            ok = 0;
+            break;
+        }
+        army->cell[i] = unit_cell(army->x[i], army->y[i]);
+        army_link(army, slot, army->cell[i]);
+    }
+    sys_free(memory);
+    return ok;
+}
+
+// 1 when v is finite and lands on a tile of the map
+static int snapshot_tile_valid(float v, int map_size) {
+    // NOTE: range first, unit_tile_coord turns v into an int
+    if(!(v > -(float)map_size && v < 2.0f * map_size)) {
+        return 0;
+    }
+    int t = unit_tile_coord(v);
+    return t >= 0 && t < map_size;
+}
+
+// 0 when a unit's type, hp, damage, speed, position, slot, path or field is
+// outside what was read, or the free slots don't chain through exactly the
+// slots no unit holds
+static int snapshot_army_valid(Army *army, int map_size) {
+    for(int i = 0; i < army->count; i++) {
+        int inside = snapshot_tile_valid(army->x[i], map_size) && snapshot_tile_valid(army->y[i], map_size)
+                     && snapshot_tile_valid(army->look_x[i], map_size) && snapshot_tile_valid(army->look_y[i], map_size);
+        if(!inside || !isfinite(army->speed[i]) || army->hp[i] <= -START_HP || army->hp[i] > START_HP
+           || army->damage[i] < 0 || army->damage[i] > START_HP
+           || army->type[i] <= UNIT_TYPE_NONE || army->type[i] >= UNIT_TYPE_MAX
+           || army->slot[i] >= army->slot_count || army->slot_dense[army->slot[i]] != (uint32_t)i
+           || army->flow[i] >= FLOW_FIELD_MAX
+           || army->path_count[i] > army->path_used || army->path_start[i] > army->path_used - army->path_count[i]
+           || army->path_next[i] > army->path_refined[i] || army->path_refined[i] > army->path_count[i]) {
+            return 0;
+        }
+    }
+    uint32_t free_count = army->slot_count - (uint32_t)army->count;
+    uint32_t steps = 0;
+    for(uint32_t slot = army->free_slot; slot != ARMY_NO_SLOT; slot = army->slot_dense[slot]) {
+        if(slot >= army->slot_count || ++steps > free_count) {
+            return 0;
+        }
+        uint32_t i = army->slot_dense[slot];
+        if(i < (uint32_t)army->count && army->slot[i] == slot) {
+            return 0;
+        }
+    }
+    return steps == free_count;
+}
+
+// reads into a fresh army, 0 when the header or the indices don't hold up
+static int snapshot_read_army(Snapshot_Stream *s, Army *army, int map_size) {
+    Snapshot_Army header;
+    snapshot_read(s, &header, sizeof(header));
+    if(!s->ok || header.capacity > SNAPSHOT_MAX_CAPACITY || header.count < 0 || header.count > header.capacity
+       || header.slot_count > (uint32_t)header.capacity
+       || (header.free_slot != ARMY_NO_SLOT && header.free_slot >= header.slot_count)
+       || header.path_capacity > SNAPSHOT_MAX_CAPACITY || header.path_used > header.path_capacity) {
+        return 0;
+    }
+
+    army_init(army, header.capacity > ARMY_START_CAPACITY ? header.capacity : ARMY_START_CAPACITY);
+    army->count = header.count;
+    army->slot_count = header.slot_count;
+    army->free_slot = header.free_slot;
+#define SNAPSHOT_READ_COLUMN(T, name) snapshot_read(s, army->name, sizeof(T) * (uint64_t)army->count);
+    ARMY_COLUMNS(SNAPSHOT_READ_COLUMN)
+#undef SNAPSHOT_READ_COLUMN
+    for(int c = 0; c < COOLDOWN_MAX; c++) {
+        snapshot_read(s, army->cooldown[c], sizeof(float) * (uint64_t)army->count);
+    }
+    snapshot_read(s, army->slot_dense, sizeof(uint32_t) * (uint64_t)army->slot_count);
+    snapshot_read(s, army->slot_generation, sizeof(uint32_t) * (uint64_t)army->slot_count);
+    if(header.path_capacity) {
+        army->path_memory = sys_alloc(sizeof(Path_Point) * header.path_capacity, 0);
+        army->path_points = (Path_Point *)army->path_memory.ptr;
+        army->path_capacity = header.path_capacity;
+        army->path_used = header.path_used;
+        snapshot_read(s, army->path_points, sizeof(Path_Point) * (uint64_t)army->path_used);
+    }
+    if(!s->ok || !snapshot_army_valid(army, map_size)) {
+        return 0;
+    }
+    return snapshot_read_links(s, army);
+}
+
+static void snapshot_write_flow_fields(Snapshot_Stream *s, Flow_Field_Set *set) {
+    snapshot_write(s, &set->builds, sizeof(set->builds));
+    for(int f = 0; f < FLOW_FIELD_MAX; f++) {
+        Flow_Field *field = &set->field[f];
+        Snapshot_Flow_Field header = { field->x0, field->y0, field->width, field->height, field->goal_x, field->goal_y, field->built };
+        snapshot_write(s, &header, sizeof(header));
+        snapshot_write(s, field->dir, (uint64_t)field->width * (uint64_t)field->height);
+    }
+}
+
+// reads into a fresh set, 0 when a field's region isn't inside the map
+static int snapshot_read_flow_fields(Snapshot_Stream *s, Flow_Field_Set *set, int map_size) {
+    snapshot_read(s, &set->builds, sizeof(set->builds));
+    for(int f = 0; f < FLOW_FIELD_MAX; f++) {
+        Flow_Field *field = &set->field[f];
+        Snapshot_Flow_Field header;
+        snapshot_read(s, &header, sizeof(header));
+        if(!s->ok || header.x0 < 0 || header.y0 < 0 || header.width < 0 || header.height < 0
+           || header.width > map_size - header.x0 || header.height > map_size - header.y0) {
+            return 0;
+        }
+        field->x0 = header.x0;
+        field->y0 = header.y0;
+        field->width = header.width;
+        field->height = header.height;
+        field->goal_x = header.goal_x;
+        field->goal_y = header.goal_y;
+        field->built = header.built;
+        int cells = field->width * field->height;
+        if(cells > field->capacity) {
+            if(field->memory.ptr) {
+                sys_free(field->memory);
+            }
+            field->memory = sys_alloc((size_t)cells, 0);
+            field->dir = (uint8_t *)field->memory.ptr;
+            field->capacity = cells;
+        }
+        snapshot_read(s, field->dir, (uint64_t)cells);
+    }
+    return s->ok;
+}
+
+// returns 0 when the file couldn't be written completely
+int snapshot_save(Game_State *state, const char *file_name) {
+    Map *map = &state->map;
+    // NOTE: the save goes to a temporary file that replaces the old one once
+    // it's whole, and the chunks loaded from the old one are copied out first
+    // since windows can neither cut nor replace a file that is still mapped
+    char temp_name[1024];
+    if(snprintf(temp_name, sizeof(temp_name), "%s.tmp", file_name) >= (int)sizeof(temp_name)) {
+        return 0;
+    }
+    map_make_private(map);
+    Snapshot_Stream s = { 0 };
+    s.file = sys_file_open(temp_name);
+    if(!s.file.ptr) {
+        return 0;
+    }
+    sys_file_set_size(&s.file, 0);
+    s.ok = 1;
+
+    Snapshot_Header header = { 0 };
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.map_size = (uint32_t)map->size;
+    header.chunk_size = sizeof(Map_Chunk);
+    header.cooldowns = COOLDOWN_MAX;
+    header.flow_fields = FLOW_FIELD_MAX;
+    header.chunk_count = (uint32_t)map->chunks_allocated;
+    s.offset = sizeof(header);
+
+    Snapshot_Game game;
+    memset(&game, 0, sizeof(game));
+    game.mouse_released = state->mouse_released;
+    game.mouse_pressed = state->mouse_pressed;
+    game.camera = state->camera;
+    game.map_seed = state->map_seed;
+    game.map_generated = map->generated;
+    game.rand = state->rand;
+    game.resource_ticks = state->resource_ticks;
+    game.enemy_spawn_time = state->enemy_spawn_time;
+    game.horde_field = state->horde_field;
+    game.horde_field_time = state->horde_field_time;
+    game.sim_accumulator = state->sim_accumulator;
+    game.sim_alpha = state->sim_alpha;
+    game.tick = state->tick;
+    game.frame = state->frame;
+    game.selection_count = state->selection_count;
+    snapshot_write(&s, &game, sizeof(game));
+
+    // MAP, the table maps a chunk to its place in the chunk array
+    int table_count = map->chunk_count * map->chunk_count;
+    Sys_Memory table_memory = sys_alloc(sizeof(uint32_t) * (size_t)table_count, 0);
+    uint32_t *table = (uint32_t *)table_memory.ptr;
+    uint32_t chunks = 0;
+    for(int c = 0; c < table_count; c++) {
+        table[c] = map->chunk[c] ? chunks++ : SNAPSHOT_NO_CHUNK;
+    }
+    snapshot_write(&s, table, sizeof(uint32_t) * (uint64_t)table_count);
+    sys_free(table_memory);
+    s.offset = (s.offset + 63) & ~(uint64_t)63;
+    header.chunks_offset = s.offset;
+    for(int c = 0; c < table_count; c++) {
+        if(map->chunk[c]) {
+            snapshot_write(&s, map->chunk[c], sizeof(Map_Chunk));
+        }
+    }
+
+    // ARMIES
+    snapshot_write_army(&s, &state->ally);
+    snapshot_write_army(&s, &state->enemy);
+    for(int i = 0; i < state->selection_count; i++) {
+        int u = army_index(&state->ally, state->selection[i]);
+        snapshot_write(&s, &u, sizeof(u));
+    }
+    snapshot_write_flow_fields(&s, &state->flow_fields);
+    snapshot_write_flow_fields(&s, &state->horde_fields);
+
+    // NOTE: the header goes last so a save cut short never passes as whole
+    header.size = s.offset;
+    uint64_t end = s.offset;
+    s.offset = 0;
+    snapshot_write(&s, &header, sizeof(header));
+    sys_file_close(s.file);
+    s.ok = s.ok && sys_file_replace(temp_name, file_name);
+    if(!s.ok) {
+        printf("failed to write %s\n", file_name);
+    } else {
+        printf("saved %s, %" PRIu64 " bytes\n", file_name, end);
+    }
+    return s.ok;
+}
+
+// replaces the map, armies and flow fields with the ones in the file.
+// returns 0 and leaves the state alone when the file isn't a snapshot this
+// build can read
+int snapshot_load(Game_State *state, const char *file_name) {
+    Snapshot_Stream s = { 0 };
+    s.file = sys_file_open_read(file_name);
+    if(!s.file.ptr) {
+        return 0;
+    }
+    s.ok = 1;
+
+    Snapshot_Header header;
+    memset(&header, 0, sizeof(header));
+    snapshot_read(&s, &header, sizeof(header));
+    if(!s.ok || header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION
+       || header.map_size != MAP_GRID_SIZE || header.chunk_size != sizeof(Map_Chunk)
+       || header.cooldowns != COOLDOWN_MAX || header.flow_fields != FLOW_FIELD_MAX
+       || header.size != s.file.size) {
+        printf("%s is not a snapshot this build can load\n", file_name);
+        sys_file_close(s.file);
+        return 0;
+    }
+
+    Snapshot_Game game;
+    snapshot_read(&s, &game, sizeof(game));
+    s.ok = s.ok && game.horde_field >= -1 && game.horde_field < FLOW_FIELD_MAX
+           && game.selection_count >= 0 && (uint64_t)game.selection_count * sizeof(int) <= header.size;
+
+    // MAP, the table has to list the chunk array in order like saving wrote it
+    Map map;
+    map_init(&map, (int)header.map_size);
+    map.seed = game.map_seed;
+    map.generated = game.map_generated != 0;
+    int table_count = map.chunk_count * map.chunk_count;
+    Sys_Memory table_memory = sys_alloc(sizeof(uint32_t) * (size_t)table_count, 0);
+    uint32_t *table = (uint32_t *)table_memory.ptr;
+    snapshot_read(&s, table, sizeof(uint32_t) * (uint64_t)table_count);
+    uint32_t listed = 0;
+    for(int c = 0; c < table_count && s.ok; c++) {
+        if(table[c] != SNAPSHOT_NO_CHUNK) {
+            s.ok = table[c] == listed++;
+        }
+    }
+    uint64_t chunks_size = sizeof(Map_Chunk) * (uint64_t)header.chunk_count;
+    s.ok = s.ok && listed == header.chunk_count && header.chunks_offset >= s.offset && header.chunks_offset % 64 == 0
+           && header.chunks_offset <= header.size && chunks_size <= header.size - header.chunks_offset;
+    s.offset = header.chunks_offset;
+    if(s.ok && header.chunk_count) {
+        map.view = sys_file_map(s.file, s.offset, chunks_size, SYS_FILE_MAP_COPY);
+        Map_Chunk *chunks = (Map_Chunk *)map.view.ptr;
+        if(chunks) {
+            for(int c = 0; c < table_count; c++) {
+                map.chunk[c] = table[c] != SNAPSHOT_NO_CHUNK ? &chunks[table[c]] : 0;
+            }
+            map.chunks_allocated = (int)header.chunk_count;
+        } else {
+            s.ok = 0;
+        }
+    }
+    s.offset += chunks_size;
+    sys_free(table_memory);
+
+    // ARMIES and the fields they follow
+    Army ally, enemy;
+    memset(&ally, 0, sizeof(ally));
+    memset(&enemy, 0, sizeof(enemy));
+    s.ok = s.ok && snapshot_read_army(&s, &ally, map.size) && snapshot_read_army(&s, &enemy, map.size);
+    Sys_Memory selection_memory = { 0 };
+    int *selection = 0;
+    if(s.ok && game.selection_count) {
+        selection_memory = sys_alloc(sizeof(int) * (size_t)game.selection_count, 0);
+        selection = (int *)selection_memory.ptr;
+        snapshot_read(&s, selection, sizeof(int) * (uint64_t)game.selection_count);
+    }
+    Flow_Field_Set flow_fields, horde_fields;
+    memset(&flow_fields, 0, sizeof(flow_fields));
+    memset(&horde_fields, 0, sizeof(horde_fields));
+    s.ok = s.ok && snapshot_read_flow_fields(&s, &flow_fields, map.size)
+           && snapshot_read_flow_fields(&s, &horde_fields, map.size) && s.offset == header.size;
+    sys_file_close(s.file);
+
+    if(!s.ok) {
+        printf("%s is damaged, nothing was loaded\n", file_name);
+        map_free(&map);
+        army_free(&ally);
+        army_free(&enemy);
+        flow_fields_free(&flow_fields);
+        flow_fields_free(&horde_fields);
+        if(selection_memory.ptr) {
+            sys_free(selection_memory);
+        }
+        return 0;
+    }
+
+    state->mouse_released = game.mouse_released;
+    state->mouse_pressed = game.mouse_pressed;
+    state->camera = game.camera;
+    state->map_seed = game.map_seed;
+    state->rand = game.rand;
+    state->resource_ticks = game.resource_ticks;
+    state->enemy_spawn_time = game.enemy_spawn_time;
+    state->horde_field = game.horde_field;
+    state->horde_field_time = game.horde_field_time;
+    state->sim_accumulator = game.sim_accumulator;
+    state->sim_alpha = game.sim_alpha;
+    state->tick = game.tick;
+    state->frame = game.frame;
+
+    // chunks written after loading come from new blocks as usual
+    map_free(&state->map);
+    state->map = map;
+    path_graph_free(&state->path_graph);
+    path_graph_init(&state->path_graph, &state->map);
+    path_regions_free(&state->path_finder);
+
+    army_free(&state->ally);
+    army_free(&state->enemy);
+    state->ally = ally;
+    state->enemy = enemy;
+    selection_clear(state);
+    for(int i = 0; i < game.selection_count; i++) {
+        int u = selection[i];
+        if(u >= 0 && u < state->ally.count) {
+            selection_add(state, army_handle(&state->ally, u));
+        }
+    }
+    if(selection_memory.ptr) {
+        sys_free(selection_memory);
+    }
+    flow_fields_free(&state->flow_fields);
+    flow_fields_free(&state->horde_fields);
+    state->flow_fields = flow_fields;
+    state->horde_fields = horde_fields;
+
+#ifndef SYS_HEADLESS
+    // a cached mesh can match a loaded chunk's place and version, not its tiles
+    for(int i = 0; i < TILE_CACHE_SIZE; i++) {
+        state->tile_renderer.mesh[i].chunk_x = -1;
+        state->tile_renderer.mesh[i].chunk_y = -1;
+    }
+#endif
+    return 1;
+}
+
+#ifndef SYS_HEADLESS
+#define color_pink 1.0f, 0.0f, 0.5f
+#define color_red 1.0f, 0.0f, 0.0f
+#define color_selection_box 0.2f, 0.7f, 0.2f, 0.4f
+#define color_white 1.0f, 1.0f, 1.0f
+#define color_ally 0.0f, 1.0f, 1.0f
+
+//=============================================================================
+//
+//
+//  TILE RENDERING
+//
+//
+//=============================================================================
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
+typedef void APIENTRY gl_gen_buffers(int n, unsigned int *buffers);
+typedef void APIENTRY gl_delete_buffers(int n, const unsigned int *buffers);
+typedef void APIENTRY gl_bind_buffer(unsigned int target, unsigned int buffer);
+typedef void APIENTRY gl_buffer_data(unsigned int target, ptrdiff_t size, const void *data, unsigned int usage);
+typedef void *APIENTRY gl_map_buffer(unsigned int target, unsigned int access);
+typedef unsigned char APIENTRY gl_unmap_buffer(unsigned int target);
+
+static gl_gen_buffers *__glGenBuffers;
+static gl_delete_buffers *__glDeleteBuffers;
+static gl_bind_buffer *__glBindBuffer;
+static gl_buffer_data *__glBufferData;
+static gl_map_buffer *__glMapBuffer;
+static gl_unmap_buffer *__glUnmapBuffer;
+
+void tile_renderer_init(Tile_Renderer *renderer) {
+    __glGenBuffers = (gl_gen_buffers *)sys_gl_proc("glGenBuffers");
+    __glDeleteBuffers = (gl_delete_buffers *)sys_gl_proc("glDeleteBuffers");
+    __glBindBuffer = (gl_bind_buffer *)sys_gl_proc("glBindBuffer");
+    __glBufferData = (gl_buffer_data *)sys_gl_proc("glBufferData");
+    __glMapBuffer = (gl_map_buffer *)sys_gl_proc("glMapBuffer");
+    __glUnmapBuffer = (gl_unmap_buffer *)sys_gl_proc("glUnmapBuffer");
+    renderer->has_vbo = __glGenBuffers && __glDeleteBuffers && __glBindBuffer && __glBufferData;
+
+    // NOTE: the cpu copy is what gets drawn when there are no vbos (gl < 1.5)
+    renderer->memory = sys_alloc(sizeof(Draw_Vertex) * TILE_CHUNK_VERTICES * TILE_CACHE_SIZE, 0);
+    for(int i = 0; i < TILE_CACHE_SIZE; i++) {
+        Tile_Chunk_Mesh *mesh = &renderer->mesh[i];
+        mesh->chunk_x = -1;
+        mesh->chunk_y = -1;
+        mesh->vertices = (Draw_Vertex *)renderer->memory.ptr + i * TILE_CHUNK_VERTICES;
+        if(renderer->has_vbo) {
+            __glGenBuffers(1, &mesh->buffer);
+        }
+    }
+}
+
+void tile_renderer_free(Tile_Renderer *renderer) {
+    for(int i = 0; i < TILE_CACHE_SIZE; i++) {
+        if(renderer->mesh[i].buffer) {
+            __glDeleteBuffers(1, &renderer->mesh[i].buffer);
+        }
+    }
+    if(renderer->memory.ptr) {
+        sys_free(renderer->memory);
+    }
+    memset(renderer, 0, sizeof(*renderer));
+}
+
+static void tile_chunk_build(Game_State *state, Tile_Chunk_Mesh *mesh, int chunk_x, int chunk_y) {
+    float tile_size = 1.0f / state->sprite_sheet.width * SPRITE_SIZE;
+    Draw_Vertex *v = mesh->vertices;
+    Map_Chunk *chunk = map_chunk_touch(&state->map, chunk_x, chunk_y);
+
+    // vertices are in map tile units, the camera is applied when drawing
+    for(int i = 0; i < TILE_CHUNK_SIZE; i++) {
+        for(int j = 0; j < TILE_CHUNK_SIZE; j++) {
+            int tx = chunk_x * TILE_CHUNK_SIZE + i;
+            int ty = chunk_y * TILE_CHUNK_SIZE + j;
+            float t = (float)(chunk ? chunk->tile[i][j] : map_default_tile).type;
+            float x = (float)tx;
+            float y = (float)ty;
+            v[0].x = x;     v[0].y = y + 1; v[0].u = t * tile_size;     v[0].v = 0.0f;
+            v[1].x = x + 1; v[1].y = y + 1; v[1].u = (t+1) * tile_size; v[1].v = 0.0f;
+            v[2].x = x + 1; v[2].y = y;     v[2].u = (t+1) * tile_size; v[2].v = tile_size;
+            v[3].x = x;     v[3].y = y;     v[3].u = t * tile_size;     v[3].v = tile_size;
+            v += 4;
+        }
+    }
+
+    if(state->tile_renderer.has_vbo) {
+        __glBindBuffer(GL_ARRAY_BUFFER, mesh->buffer);
+        __glBufferData(GL_ARRAY_BUFFER, sizeof(Draw_Vertex) * TILE_CHUNK_VERTICES, mesh->vertices, GL_STATIC_DRAW);
+    }
+
+    mesh->chunk_x = chunk_x;
+    mesh->chunk_y = chunk_y;
+    mesh->version = map_chunk_version(&state->map, chunk_x, chunk_y);
+}
+
+// finds or builds the mesh for a chunk, evicting the least recently drawn one
+static Tile_Chunk_Mesh *tile_chunk_mesh(Game_State *state, int chunk_x, int chunk_y) {
+    Tile_Renderer *renderer = &state->tile_renderer;
+    Tile_Chunk_Mesh *mesh = 0;
+
+    for(int i = 0; i < TILE_CACHE_SIZE; i++) {
+        if(renderer->mesh[i].chunk_x == chunk_x && renderer->mesh[i].chunk_y == chunk_y) {
+            mesh = &renderer->mesh[i];
+            break;
+        }
+    }
+    if(!mesh) {
+        mesh = &renderer->mesh[0];
+        for(int i = 1; i < TILE_CACHE_SIZE; i++) {
+            if(renderer->mesh[i].last_used < mesh->last_used) {
+                mesh = &renderer->mesh[i];
+            }
+        }
+        tile_chunk_build(state, mesh, chunk_x, chunk_y);
+    } else if(mesh->version != map_chunk_version(&state->map, chunk_x, chunk_y)) {
+        tile_chunk_build(state, mesh, chunk_x, chunk_y);
+    }
+
+    mesh->last_used = state->frame;
+    return mesh;
+}
+
+void draw_map(Game_State *state) {
+    Tile_Renderer *renderer = &state->tile_renderer;
+    // NOTE(rayalan): the camera position is the top left most square
+    int first_x = (int)state->camera.x + 1;
+    int first_y = (int)state->camera.y + 1;
+    int chunk_x0 = map_chunk_coord(&state->map, first_x);
+    int chunk_y0 = map_chunk_coord(&state->map, first_y);
+    int chunk_x1 = map_chunk_coord(&state->map, first_x + GRID_SIZE - 1);
+    int chunk_y1 = map_chunk_coord(&state->map, first_y + GRID_SIZE - 1);
+
+    glBindTexture(GL_TEXTURE_2D, state->sprite_sheet.id);
+    glColor3f(color_white);
+    glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0.0f, GRID_SIZE, GRID_SIZE, 0.0f, 0.0f, 1.0f);
+        glTranslatef((float)-first_x, (float)-first_y, 0.0f);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+        for(int chunk_y = chunk_y0; chunk_y <= chunk_y1; chunk_y++) {
+            for(int chunk_x = chunk_x0; chunk_x <= chunk_x1; chunk_x++) {
+                Tile_Chunk_Mesh *mesh = tile_chunk_mesh(state, chunk_x, chunk_y);
+                if(renderer->has_vbo) {
+                    __glBindBuffer(GL_ARRAY_BUFFER, mesh->buffer);
+                    glVertexPointer(2, GL_FLOAT, sizeof(Draw_Vertex), (void *)0);
+                    glTexCoordPointer(2, GL_FLOAT, sizeof(Draw_Vertex), (void *)(2 * sizeof(float)));
+                } else {
+                    glVertexPointer(2, GL_FLOAT, sizeof(Draw_Vertex), &mesh->vertices[0].x);
+                    glTexCoordPointer(2, GL_FLOAT, sizeof(Draw_Vertex), &mesh->vertices[0].u);
+                }
+                glDrawArrays(GL_QUADS, 0, TILE_CHUNK_VERTICES);
+            }
+        }
+
+        if(renderer->has_vbo) {
+            __glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    glPopMatrix();
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//=============================================================================
+//
+//
+//  SPRITE BATCHING
+//
+//
+//=============================================================================
+#define SPRITE_BATCH_MIN_CAPACITY 1024
+
+// NOTE: call after tile_renderer_init, it loads the buffer functions
+void sprite_batch_init(Sprite_Batch *batch) {
+    memset(batch, 0, sizeof(*batch));
+    batch->has_vbo = __glGenBuffers && __glBindBuffer && __glBufferData && __glMapBuffer && __glUnmapBuffer;
+    if(batch->has_vbo) {
+        __glGenBuffers(1, &batch->buffer);
+    }
+}
+
+void sprite_batch_free(Sprite_Batch *batch) {
+    if(batch->buffer) {
+        __glDeleteBuffers(1, &batch->buffer);
+    }
+    if(batch->memory.ptr) {
+        sys_free(batch->memory);
+    }
+    memset(batch, 0, sizeof(*batch));
+}
+
+static void sprite_batch_grow(Sprite_Batch *batch, int capacity) {
+    size_t vertex_size = batch->has_vbo ? 0 : sizeof(Draw_Vertex) * 4;
+    Sys_Memory memory = sys_alloc((sizeof(Sprite_Instance) + vertex_size) * capacity, 0);
+    Sprite_Instance *instances = (Sprite_Instance *)memory.ptr;
+    if(batch->count) {
+        memcpy(instances, batch->instances, sizeof(Sprite_Instance) * batch->count);
+    }
+    if(batch->memory.ptr) {
+        sys_free(batch->memory);
+    }
+    batch->memory = memory;
+    batch->instances = instances;
+    batch->vertices = batch->has_vbo ? 0 : (Draw_Vertex *)(instances + capacity);
+    batch->capacity = capacity;
+}
+
+void sprite_batch_begin(Sprite_Batch *batch) {
+    batch->count = 0;
+}
+
+static inline void sprite_batch_push(Sprite_Batch *batch, float x, float y, uint32_t atlas) {
+    if(batch->count == batch->capacity) {
+        sprite_batch_grow(batch, batch->capacity ? batch->capacity * 2 : SPRITE_BATCH_MIN_CAPACITY);
+    }
+    Sprite_Instance *instance = &batch->instances[batch->count++];
+    instance->x = x;
+    instance->y = y;
+    instance->atlas = atlas;
+}
+
+// expands every pushed sprite into a quad and draws them all in one call,
+// positions are in map tiles under the current matrix and bound texture
+void sprite_batch_flush(Sprite_Batch *batch, Sprite_Sheet *sheet) {
+    if(!batch->count) {
+        return;
+    }
+
+    uint32_t columns = (uint32_t)(sheet->width / SPRITE_SIZE);
+    float tile_size = 1.0f / columns;
+    Draw_Vertex *v = batch->vertices;
+    if(batch->has_vbo) {
+        __glBindBuffer(GL_ARRAY_BUFFER, batch->buffer);
+        // NOTE: orphaning last frame's storage keeps the map from waiting on the gpu
+        __glBufferData(GL_ARRAY_BUFFER, sizeof(Draw_Vertex) * 4 * batch->capacity, 0, GL_STREAM_DRAW);
+        v = (Draw_Vertex *)__glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    }
+
+    int drawn = 0;
+    if(v) {
+        for(int i = 0; i < batch->count; i++) {
+            Sprite_Instance *s = &batch->instances[i];
+            float u0 = (s->atlas % columns) * tile_size;
+            float v0 = (s->atlas / columns) * tile_size;
+            float u1 = u0 + tile_size;
+            float v1 = v0 + tile_size;
+            v[0].x = s->x;     v[0].y = s->y + 1; v[0].u = u0; v[0].v = v0;
+            v[1].x = s->x + 1; v[1].y = s->y + 1; v[1].u = u1; v[1].v = v0;
+            v[2].x = s->x + 1; v[2].y = s->y;     v[2].u = u1; v[2].v = v1;
+            v[3].x = s->x;     v[3].y = s->y;     v[3].u = u0; v[3].v = v1;
+            v += 4;
+        }
+        drawn = batch->count;
+    }
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    if(batch->has_vbo) {
+        // NOTE: unmap fails when the storage was lost (mode switch), skip the frame
+        if(v && !__glUnmapBuffer(GL_ARRAY_BUFFER)) {
+            drawn = 0;
+        }
+        glVertexPointer(2, GL_FLOAT, sizeof(Draw_Vertex), (void *)0);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Draw_Vertex), (void *)(2 * sizeof(float)));
+    } else {
+        glVertexPointer(2, GL_FLOAT, sizeof(Draw_Vertex), &batch->vertices[0].x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Draw_Vertex), &batch->vertices[0].u);
+    }
+    if(drawn) {
+        glDrawArrays(GL_QUADS, 0, drawn * 4);
+    }
+    if(batch->has_vbo) {
+        __glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    batch->count = 0;
+}
+
+//=============================================================================
+//
+//
+//  PROFILER OVERLAY
+//
+//
+//=============================================================================
+#define PROFILE_OVERLAY_WIDTH 480.0f
+#define PROFILE_OVERLAY_GRAPH_HEIGHT 64.0f
+#define PROFILE_OVERLAY_ROW 12.0f
+#define PROFILE_OVERLAY_TARGET_MS (1000.0 / 60.0) // the graph's full height
+
+static const float profile_depth_colors[PROFILE_MAX_DEPTH][3] = {
+    { 0.9f, 0.4f, 0.2f }, { 0.9f, 0.7f, 0.2f }, { 0.5f, 0.8f, 0.3f }, { 0.2f, 0.7f, 0.8f },
+    { 0.4f, 0.4f, 0.9f }, { 0.7f, 0.4f, 0.8f }, { 0.8f, 0.4f, 0.6f }, { 0.6f, 0.6f, 0.6f },
+};
+
+static void profile_rect(float x0, float y0, float x1, float y1) {
+    glVertex2f(x0, y0);
+    glVertex2f(x1, y0);
+    glVertex2f(x1, y1);
+    glVertex2f(x0, y1);
+}
+
+// frame time history, a flame chart of the last finished frame and the
+// averaged time of each of its blocks. drawn in window pixels
+void draw_profiler(Sys_State *sys) {
+    if(profiler.frame_count < 2) {
+        return;
+    }
+    Profile_Frame *last = profile_frame(profiler.frame_count - 2);
+    float left = 8.0f;
+    float top = 8.0f;
+    float width = PROFILE_OVERLAY_WIDTH;
+    float graph_bottom = top + PROFILE_OVERLAY_GRAPH_HEIGHT;
+    float flame_top = graph_bottom + 4.0f;
+    float list_top = flame_top + PROFILE_MAX_DEPTH * PROFILE_OVERLAY_ROW + 4.0f;
+    float bottom = list_top + (float)last->count * PROFILE_OVERLAY_ROW + 4.0f;
+    bottom = bottom < (float)sys->height - 8.0f ? bottom : (float)sys->height - 8.0f;
+
+    glBegin(GL_QUADS);
+        glColor4f(0.0f, 0.0f, 0.0f, 0.7f);
+        profile_rect(left - 4.0f, top - 4.0f, left + width + 4.0f, bottom);
+
+        // one bar per frame in the ring, oldest on the left
+        uint64_t frames = profiler.frame_count - 1 < PROFILE_FRAMES ? profiler.frame_count - 1 : PROFILE_FRAMES - 1;
+        float bar = width / (PROFILE_FRAMES - 1);
+        for(uint64_t f = 0; f < frames; f++) {
+            Profile_Frame *frame = profile_frame(profiler.frame_count - 1 - frames + f);
+            double ms = profile_ms(frame->end - frame->start);
+            float h = (float)(ms / PROFILE_OVERLAY_TARGET_MS) * PROFILE_OVERLAY_GRAPH_HEIGHT;
+            h = h < PROFILE_OVERLAY_GRAPH_HEIGHT ? h : PROFILE_OVERLAY_GRAPH_HEIGHT;
+            if(ms > PROFILE_OVERLAY_TARGET_MS) {
+                glColor3f(color_red);
+            } else {
+                glColor3f(0.3f, 0.8f, 0.3f);
+            }
+            profile_rect(left + f * bar, graph_bottom - h, left + (f + 1) * bar - 1.0f, graph_bottom);
+        }
+
+        // flame chart, the frame spans the whole width
+        double span = (double)(last->end - last->start);
+        span = span > 0.0 ? span : 1.0;
+        for(int b = 0; b < last->count; b++) {
+            Profile_Block *block = &last->block[b];
+            float x0 = left + (float)((double)(block->start - last->start) / span) * width;
+            float x1 = left + (float)((double)(block->end - last->start) / span) * width;
+            float y0 = flame_top + block->depth * PROFILE_OVERLAY_ROW;
+            const float *c = profile_depth_colors[block->depth];
+            glColor3f(c[0], c[1], c[2]);
+            profile_rect(x0, y0, x1 > x0 + 1.0f ? x1 : x0 + 1.0f, y0 + PROFILE_OVERLAY_ROW - 1.0f);
+        }
+    glEnd();
+
+    char text[128];
+    glColor3f(color_white);
+    snprintf(text, sizeof(text), "%.2f ms", profile_ms(last->end - last->start));
+    left_string(left + 2.0f, top + 2.0f, 1.0f, text);
+    for(int b = 0; b < last->count; b++) {
+        Profile_Block *block = &last->block[b];
+        double unit_ns;
+        double ms = profile_average(block->name, &unit_ns);
+        float y = list_top + b * PROFILE_OVERLAY_ROW;
+        if(y + PROFILE_OVERLAY_ROW > bottom) {
+            break;
+        }
+        left_string(left + block->depth * 8.0f, y, 1.0f, (char *)block->name);
+        if(unit_ns > 0.0) {
+            snprintf(text, sizeof(text), "%7.3f ms %8.1f ns/unit", ms, unit_ns);
+        } else {
+            snprintf(text, sizeof(text), "%7.3f ms", ms);
+        }
+        right_string(left + width, y, 1.0f, text);
+    }
+}
+#endif /* SYS_HEADLESS */
+
 Sys_Config init(int argc, char **argv) {
     sys_unused(argc);
     sys_unused(argv);
 
     freopen(LOG_FILE, "w", stdout);
+#ifdef GAME_TRACE
+    sys_trace_start(TRACE_FILE);
+#endif
+    profile_begin("init");
 
     Sys_Config cfg = { 0 };
     cfg.width = 1024; // let's do 4:3 for the classic starcraft vibe
@@ -172,6 +3974,43 @@ Sys_Config init(int argc, char **argv) {
 
     Game_State *state = (Game_State *)cfg.memory.ptr;
 
+    sys_job_init(0);
+
+    Replay_Mode replay_mode = REPLAY_OFF;
+    const char *replay_file = REPLAY_FILE;
+    const char *snapshot_file = 0;
+#ifdef SYS_HEADLESS
+    // usage: ld40_headless [frames] [seed | snapshot] [replay], a replay
+    // brings its own seed and ends the run when it runs out
+    if(argc > 0) {
+        state->frame_limit = strtoull(argv[0], NULL, 10);
+    }
+    if(argc > 1) {
+        if(argv[1][0] >= '0' && argv[1][0] <= '9') {
+            state->map_seed = strtoull(argv[1], NULL, 10);
+        } else {
+            snapshot_file = argv[1];
+        }
+    }
+    if(argc > 2) {
+        replay_mode = REPLAY_PLAY;
+        replay_file = argv[2];
+    }
+#else
+    // usage: ld40 [record | replay | load] [file]
+    if(argc > 0) {
+        if(strcmp(argv[0], "record") == 0) {
+            replay_mode = REPLAY_RECORD;
+        } else if(strcmp(argv[0], "replay") == 0) {
+            replay_mode = REPLAY_PLAY;
+        } else if(strcmp(argv[0], "load") == 0) {
+            snapshot_file = argc > 1 ? argv[1] : SNAPSHOT_FILE;
+        }
+    }
+    if(argc > 1) {
+        replay_file = argv[1];
+    }
+
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_BLEND);
     glEnable(GL_TEXTURE_2D);
@@ -196,57 +4035,77 @@ Sys_Config init(int argc, char **argv) {
     stbi_image_free(data);
     glBindTexture(GL_TEXTURE_2D, 0); 
 
+    tile_renderer_init(&state->tile_renderer);
+    sprite_batch_init(&state->sprite_batch);
+#endif /* SYS_HEADLESS */
 
-    int map_seed = (int)sys_time_now() ^ (int)(&cfg);
-    srand(map_seed);
 
-    // MAP GENERATION
-    // ========================================================================
-    for(int i = 0; i < MAP_GRID_SIZE; i++) {
-        for(int j = 0; j < MAP_GRID_SIZE; j++) {
-            // this means that the type can indicate any texture from the bottom row of the sprite sheet
-            int k = (int)rand() % 100;
-            int t = 0;
-            if (k <= 93) { t = TILE_TYPE_GRASS; }
-            else if (k <= 95) { t = TILE_TYPE_TREE; }
-            else if (k <= 96) { t = TILE_TYPE_TREE_RED; }
-            else if (k <= 97) { t = TILE_TYPE_TREE_ORANGE; }
-            else if (k <= 98) { t = TILE_TYPE_SHRUB; }
-            else if (k <= 99) { t = TILE_TYPE_SHRUB_PURPLE; }
-            else { t = TILE_TYPE_ROCK; }
-            state->tile[i][j].type = t;
-            state->tile[i][j].resource = 10 * t;
+    if(replay_mode == REPLAY_PLAY) {
+        uint64_t seed = replay_play_start(replay_file);
+        state->map_seed = seed ? seed : state->map_seed;
+    }
+    if(!state->map_seed) {
+        state->map_seed = (uint64_t)(sys_time_now() * 1000000.0) ^ (uint64_t)(intptr_t)(&cfg);
+    }
+    if(replay_mode == REPLAY_RECORD) {
+        replay_record_start(replay_file, state->map_seed);
+    }
+    sys_rand_seed(&state->rand, state->map_seed, 1);
+    state->horde_field = -1;
+
+    // a snapshot stands in for generating the map and spawning units
+    path_finder_init(&state->path_finder);
+    if(snapshot_file) {
+        int loaded = 0;
+        PROFILE_BLOCK("snapshot load") {
+            loaded = snapshot_load(state, snapshot_file);
+        }
+        if(loaded) {
+            profile_end();
+            return cfg;
         }
     }
 
+    // MAP GENERATION
+    // ========================================================================
     state->camera.x = 512;
     state->camera.y = 512;
+    PROFILE_BLOCK("map generate") {
+        // the rest of the map is generated as it's touched
+        int left = (int)state->camera.x - MAP_START_MARGIN;
+        int top = (int)state->camera.y - MAP_START_MARGIN;
+        map_init(&state->map, MAP_GRID_SIZE);
+        map_generate(&state->map, state->map_seed, left, top, left + GRID_SIZE + 2 * MAP_START_MARGIN, top + GRID_SIZE + 2 * MAP_START_MARGIN);
+    }
+    PROFILE_BLOCK("path init") {
+        path_graph_init(&state->path_graph, &state->map);
+    }
 
     // SPAWN UNITS
     // ========================================================================
-    state->ally_count = 0;
-    state->enemy_count = 0;
+    profile_begin("spawn units");
+    army_init(&state->ally, ARMY_START_CAPACITY);
+    army_init(&state->enemy, ARMY_START_CAPACITY);
 
     for(int i = state->camera.x; i < state->camera.x + GRID_SIZE; i++) {
         for(int j = state->camera.y; j < state->camera.y + GRID_SIZE; j++) {
-            if(state->tile[i][j].type == TILE_TYPE_GRASS) {
-                unsigned int k = rand() % 100;
-                if(k <= 2 && state->ally_count < START_UNITS) {
-                    state->ally[state->ally_count].x = (float)i;
-                    state->ally[state->ally_count].y = (float)j;
-                    state->ally[state->ally_count].type = k > 1 ? UNIT_TYPE_MALE : UNIT_TYPE_FEMALE;
-                    state->ally[state->ally_count].hp = START_HP;
-                    state->ally[state->ally_count].resource = START_RESOURCE;
-                    state->ally_count++;
+            if(map_get(&state->map, unit_tile_coord((float)i), unit_tile_coord((float)j)).type == TILE_TYPE_GRASS) {
+                uint32_t k = sys_rand_range(&state->rand, 100);
+                if(k <= 2 && state->ally.count < START_UNITS) {
+                    Unit_Handle h = army_spawn(&state->ally, k > 1 ? UNIT_TYPE_MALE : UNIT_TYPE_FEMALE, (float)i, (float)j);
+                    state->ally.resource[army_index(&state->ally, h)] = START_RESOURCE;
                 }    
             }
         }
     }
+    profile_end();
 
+    profile_end();
     return cfg;
 }
 
-inline void init_gl(int w, int h) 
+#ifndef SYS_HEADLESS
+static inline void init_gl(int w, int h) 
 {
     glClear(GL_COLOR_BUFFER_BIT);
     glMatrixMode(GL_PROJECTION);
@@ -254,19 +4113,606 @@ inline void init_gl(int w, int h)
     glViewport(0, 0, w, h);
     glOrtho(0.0f, w, h, 0.0f, 0.0f, 1.0f);
 }
+#endif /* SYS_HEADLESS */
 
-#define color_pink 1.0f, 0.0f, 0.5f
-#define color_red 1.0f, 0.0f, 0.0f
-#define color_selection_box 0.2f, 0.7f, 0.2f, 0.4f
-#define color_white 1.0f, 1.0f, 1.0f
-#define color_ally 0.0f, 1.0f, 1.0f
+//=============================================================================
+//
+//
+//  MOVEMENT
+//
+//
+//=============================================================================
+// NOTE: one branch free kernel per instruction set, picked at compile time.
+// the lanes do exactly what move_units_scalar does so every path produces the
+// same positions bit for bit. define GAME_NO_SIMD to force the scalar path.
+static void move_units_scalar(Army *army, int start, int end, float dt) {
+    for(int i = start; i < end; i++) {
+        if(!(army->flags[i] & UNIT_FLAG_MOVING)) {
+            continue;
+        }
 
-void loop(Sys_State *sys) {
-    Game_State *state = (Game_State *)sys->memory.ptr;
-    init_gl(sys->width, sys->height); 
+        if(army->x[i] < army->look_x[i] + 0.1f && army->x[i] > army->look_x[i] - 0.1f
+                && army->y[i] < army->look_y[i] + 0.1f && army->y[i] > army->look_y[i] - 0.1f) {
+            army->flags[i] ^= UNIT_FLAG_MOVING;
+            army->x[i] = army->look_x[i];
+            army->y[i] = army->look_y[i];
+            army->animation_frame[i] = 0;
+            army->animation_time[i] = 0;
+            continue;
+        }
+
+        army->animation_time[i] += dt;
+        if(army->animation_time[i] >= UNIT_ANIMATION_FRAME_TIME) {
+            army->animation_frame[i] = (army->animation_frame[i] + 1) % UNIT_ANIMATION_FRAMES;
+            army->animation_time[i] = 0;
+        }
+
+        float dx = 0.0f;
+        float dy = 0.0f;
+
+        if(army->x[i] < army->look_x[i] - 0.1f) {
+            dx = dt * army->speed[i];
+        } else if(army->x[i] > army->look_x[i] + 0.1f) {
+            dx = -1.0f * dt * army->speed[i]; 
+        }
+
+        if(army->y[i] < army->look_y[i] - 0.1f) {
+            dy = dt * army->speed[i];
+        } else if(army->y[i] > army->look_y[i] + 0.1f) {
+           dy = -1.0f * dt * army->speed[i];
+        }
+
+        army->x[i] += dx;
+        army->y[i] += dy;
+    }
+}
+
+#if defined(GAME_SIMD_AVX2)
+#define GAME_SIMD_WIDTH 8
+static int move_units_simd(Army *army, int start, int end, float dt) {
+    const __m256 neg_dt = _mm256_set1_ps(-1.0f * dt);
+    const __m256 margin = _mm256_set1_ps(0.1f);
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 frame_time = _mm256_set1_ps(UNIT_ANIMATION_FRAME_TIME);
+    const __m256i moving_bit = _mm256_set1_epi32(UNIT_FLAG_MOVING);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i frame_count = _mm256_set1_epi32(UNIT_ANIMATION_FRAMES);
+
+    int i = start;
+    for(; i + 8 <= end; i += 8) {
+        __m256i flags = _mm256_loadu_si256((__m256i *)(army->flags + i));
+        __m256 moving = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(flags, moving_bit), moving_bit));
+        if(!_mm256_movemask_ps(moving)) {
+            continue;
+        }
+
+        __m256 x = _mm256_loadu_ps(army->x + i);
+        __m256 y = _mm256_loadu_ps(army->y + i);
+        __m256 look_x = _mm256_loadu_ps(army->look_x + i);
+        __m256 look_y = _mm256_loadu_ps(army->look_y + i);
+        __m256 speed = _mm256_loadu_ps(army->speed + i);
+        __m256 step = _mm256_mul_ps(vdt, speed);
+        __m256 neg_step = _mm256_mul_ps(neg_dt, speed);
+        __m256 x_hi = _mm256_add_ps(look_x, margin);
+        __m256 x_lo = _mm256_sub_ps(look_x, margin);
+        __m256 y_hi = _mm256_add_ps(look_y, margin);
+        __m256 y_lo = _mm256_sub_ps(look_y, margin);
+
+        __m256 arrived = _mm256_and_ps(
+            _mm256_and_ps(_mm256_cmp_ps(x, x_hi, _CMP_LT_OQ), _mm256_cmp_ps(x, x_lo, _CMP_GT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(y, y_hi, _CMP_LT_OQ), _mm256_cmp_ps(y, y_lo, _CMP_GT_OQ)));
+        arrived = _mm256_and_ps(arrived, moving);
+        __m256 walking = _mm256_andnot_ps(arrived, moving);
+
+        __m256 dx = _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(x, x_lo, _CMP_LT_OQ), step),
+                                 _mm256_and_ps(_mm256_cmp_ps(x, x_hi, _CMP_GT_OQ), neg_step));
+        __m256 dy = _mm256_or_ps(_mm256_and_ps(_mm256_cmp_ps(y, y_lo, _CMP_LT_OQ), step),
+                                 _mm256_and_ps(_mm256_cmp_ps(y, y_hi, _CMP_GT_OQ), neg_step));
+        x = _mm256_add_ps(x, _mm256_and_ps(walking, dx));
+        y = _mm256_add_ps(y, _mm256_and_ps(walking, dy));
+        x = _mm256_blendv_ps(x, look_x, arrived);
+        y = _mm256_blendv_ps(y, look_y, arrived);
+
+        __m256 time = _mm256_loadu_ps(army->animation_time + i);
+        __m256i frame = _mm256_loadu_si256((__m256i *)(army->animation_frame + i));
+        __m256 advanced = _mm256_add_ps(time, vdt);
+        __m256 tick = _mm256_and_ps(walking, _mm256_cmp_ps(advanced, frame_time, _CMP_GE_OQ));
+        __m256i next_frame = _mm256_add_epi32(frame, one);
+        next_frame = _mm256_andnot_si256(_mm256_cmpeq_epi32(next_frame, frame_count), next_frame);
+        time = _mm256_blendv_ps(time, advanced, walking);
+        time = _mm256_andnot_ps(_mm256_or_ps(tick, arrived), time);
+        frame = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(frame), _mm256_castsi256_ps(next_frame), tick));
+        frame = _mm256_andnot_si256(_mm256_castps_si256(arrived), frame);
+        flags = _mm256_xor_si256(flags, _mm256_and_si256(_mm256_castps_si256(arrived), moving_bit));
+
+        _mm256_storeu_ps(army->x + i, x);
+        _mm256_storeu_ps(army->y + i, y);
+        _mm256_storeu_ps(army->animation_time + i, time);
+        _mm256_storeu_si256((__m256i *)(army->animation_frame + i), frame);
+        _mm256_storeu_si256((__m256i *)(army->flags + i), flags);
+    }
+    return i;
+}
+#elif defined(GAME_SIMD_SSE2)
+#define GAME_SIMD_WIDTH 4
+static inline __m128 simd_select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static int move_units_simd(Army *army, int start, int end, float dt) {
+    const __m128 neg_dt = _mm_set1_ps(-1.0f * dt);
+    const __m128 margin = _mm_set1_ps(0.1f);
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 frame_time = _mm_set1_ps(UNIT_ANIMATION_FRAME_TIME);
+    const __m128i moving_bit = _mm_set1_epi32(UNIT_FLAG_MOVING);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i frame_count = _mm_set1_epi32(UNIT_ANIMATION_FRAMES);
+
+    int i = start;
+    for(; i + 4 <= end; i += 4) {
+        __m128i flags = _mm_loadu_si128((__m128i *)(army->flags + i));
+        __m128 moving = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(flags, moving_bit), moving_bit));
+        if(!_mm_movemask_ps(moving)) {
+            continue;
+        }
+
+        __m128 x = _mm_loadu_ps(army->x + i);
+        __m128 y = _mm_loadu_ps(army->y + i);
+        __m128 look_x = _mm_loadu_ps(army->look_x + i);
+        __m128 look_y = _mm_loadu_ps(army->look_y + i);
+        __m128 speed = _mm_loadu_ps(army->speed + i);
+        __m128 step = _mm_mul_ps(vdt, speed);
+        __m128 neg_step = _mm_mul_ps(neg_dt, speed);
+        __m128 x_hi = _mm_add_ps(look_x, margin);
+        __m128 x_lo = _mm_sub_ps(look_x, margin);
+        __m128 y_hi = _mm_add_ps(look_y, margin);
+        __m128 y_lo = _mm_sub_ps(look_y, margin);
+
+        __m128 arrived = _mm_and_ps(_mm_and_ps(_mm_cmplt_ps(x, x_hi), _mm_cmpgt_ps(x, x_lo)),
+                                    _mm_and_ps(_mm_cmplt_ps(y, y_hi), _mm_cmpgt_ps(y, y_lo)));
+        arrived = _mm_and_ps(arrived, moving);
+        __m128 walking = _mm_andnot_ps(arrived, moving);
+
+        __m128 dx = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(x, x_lo), step), _mm_and_ps(_mm_cmpgt_ps(x, x_hi), neg_step));
+        __m128 dy = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(y, y_lo), step), _mm_and_ps(_mm_cmpgt_ps(y, y_hi), neg_step));
+        x = _mm_add_ps(x, _mm_and_ps(walking, dx));
+        y = _mm_add_ps(y, _mm_and_ps(walking, dy));
+        x = simd_select(arrived, look_x, x);
+        y = simd_select(arrived, look_y, y);
+
+        __m128 time = _mm_loadu_ps(army->animation_time + i);
+        __m128i frame = _mm_loadu_si128((__m128i *)(army->animation_frame + i));
+        __m128 advanced = _mm_add_ps(time, vdt);
+        __m128 tick = _mm_and_ps(walking, _mm_cmpge_ps(advanced, frame_time));
+        __m128i next_frame = _mm_add_epi32(frame, one);
+        next_frame = _mm_andnot_si128(_mm_cmpeq_epi32(next_frame, frame_count), next_frame);
+        time = simd_select(walking, advanced, time);
+        time = _mm_andnot_ps(_mm_or_ps(tick, arrived), time);
+        frame = _mm_castps_si128(simd_select(tick, _mm_castsi128_ps(next_frame), _mm_castsi128_ps(frame)));
+        frame = _mm_andnot_si128(_mm_castps_si128(arrived), frame);
+        flags = _mm_xor_si128(flags, _mm_and_si128(_mm_castps_si128(arrived), moving_bit));
+
+        _mm_storeu_ps(army->x + i, x);
+        _mm_storeu_ps(army->y + i, y);
+        _mm_storeu_ps(army->animation_time + i, time);
+        _mm_storeu_si128((__m128i *)(army->animation_frame + i), frame);
+        _mm_storeu_si128((__m128i *)(army->flags + i), flags);
+    }
+    return i;
+}
+#else
+#define GAME_SIMD_WIDTH 1
+static int move_units_simd(Army *army, int start, int end, float dt) {
+    sys_unused(army);
+    sys_unused(end);
+    sys_unused(dt);
+    return start;
+}
+#endif
+
+void move_units(Army *army, int start, int end, float dt) {
+    int i = move_units_simd(army, start, end, dt);
+    move_units_scalar(army, i, end, dt);
+}
+
+//=============================================================================
+//
+//
+//  COMBAT
+//
+//
+//=============================================================================
+// NOTE: combat runs in two phases. the update jobs only read the other army
+// and queue Attack_Events per batch. once every job is done the events are
+// summed into the damage column and a second parallel pass applies damage,
+// bleeding and slowing per unit, so no unit ever writes another one and the
+// outcome doesn't depend on which hit is seen first.
+
+// every cooldown column counts down to 0, in one sweep per column
+void cooldowns_tick(Army *army, int start, int end, float dt) {
+    for(int c = 0; c < COOLDOWN_MAX; c++) {
+        float *cooldown = army->cooldown[c];
+        int i = start;
+#if defined(GAME_SIMD_AVX2)
+        const __m256 vdt = _mm256_set1_ps(dt);
+        const __m256 zero = _mm256_setzero_ps();
+        for(; i + 8 <= end; i += 8) {
+            __m256 v = _mm256_loadu_ps(cooldown + i);
+            _mm256_storeu_ps(cooldown + i, _mm256_max_ps(_mm256_sub_ps(v, vdt), zero));
+        }
+#elif defined(GAME_SIMD_SSE2)
+        const __m128 vdt = _mm_set1_ps(dt);
+        const __m128 zero = _mm_setzero_ps();
+        for(; i + 4 <= end; i += 4) {
+            __m128 v = _mm_loadu_ps(cooldown + i);
+            _mm_storeu_ps(cooldown + i, _mm_max_ps(_mm_sub_ps(v, vdt), zero));
+        }
+#endif
+        for(; i < end; i++) {
+            float v = cooldown[i] - dt;
+            cooldown[i] = v > 0.0f ? v : 0.0f;
+        }
+    }
+}
+
+// queues a hit on unit t of foe and restarts the attack cooldown. returns
+// the batch's new event count
+static inline int combat_strike(Army *army, int i, Army *foe, int t, int damage, float attack_time, int start, int events) {
+    Attack_Event *event = &army->events[start + events];
+    event->target = army_handle(foe, t);
+    event->damage = damage;
+    army->cooldown[COOLDOWN_ATTACK][i] = attack_time;
+    return events + 1;
+}
+
+// sums the hits army queued into the damage column of foe, in batch order
+static void combat_scatter(Army *army, Army *foe) {
+    for(int start = 0; start < army->count; start += ARMY_UPDATE_BATCH) {
+        Attack_Event *events = army->events + start;
+        for(int k = 0; k < army->event_count[start / ARMY_UPDATE_BATCH]; k++) {
+            int t = army_index(foe, events[k].target);
+            if(t >= 0) {
+                foe->damage[t] += events[k].damage;
+            }
+        }
+    }
+}
+
+// design.txt: under half hp a unit bleeds out slowly, under a quarter it
+// moves very slowly
+void combat_resolve(void *data, int start, int end) {
+    Army *army = (Army *)data;
+    int dead = 0;
+    sys_trace_begin("combat resolve");
+    for(int i = start; i < end; i++) {
+        army->hp[i] -= army->damage[i];
+        army->damage[i] = 0;
+
+        if(army->flags[i] & UNIT_FLAG_BLEEDING) {
+            if(army->cooldown[COOLDOWN_BLEED][i] <= 0.0f) {
+                army->hp[i]--;
+                army->cooldown[COOLDOWN_BLEED][i] = BLEED_TIME;
+            }
+        } else if(army->hp[i] * 2 < START_HP) {
+            army->flags[i] |= UNIT_FLAG_BLEEDING;
+            army->cooldown[COOLDOWN_BLEED][i] = BLEED_TIME;
+        }
+        if(!(army->flags[i] & UNIT_FLAG_SLOW) && army->hp[i] * 4 < START_HP) {
+            army->flags[i] |= UNIT_FLAG_SLOW;
+            army->speed[i] = UNIT_SLOW_TILES_PER_SECOND;
+        }
+
+        if(army->hp[i] <= 0) {
+            army->dead[start + dead++] = i;
+        }
+    }
+    army->dead_count[start / ARMY_UPDATE_BATCH] = dead;
+    sys_trace_end();
+}
+
+// NOTE: the dead go from the highest index down, despawn only moves the last
+// unit so the indices still to go stay valid
+static void combat_bury(Army *army) {
+    int batches = (army->count + ARMY_UPDATE_BATCH - 1) / ARMY_UPDATE_BATCH;
+    for(int b = batches - 1; b >= 0; b--) {
+        for(int k = army->dead_count[b] - 1; k >= 0; k--) {
+            army_despawn(army, army_handle(army, army->dead[b * ARMY_UPDATE_BATCH + k]));
+        }
+    }
+}
+
+void combat_update(Game_State *state) {
+    combat_scatter(&state->ally, &state->enemy);
+    combat_scatter(&state->enemy, &state->ally);
+
+    Sys_Job_Counter counter = { 0 };
+    sys_job_parallel_for(combat_resolve, &state->ally, state->ally.count, ARMY_UPDATE_BATCH, &counter);
+    sys_job_parallel_for(combat_resolve, &state->enemy, state->enemy.count, ARMY_UPDATE_BATCH, &counter);
+    sys_job_wait(&counter);
+
+    combat_bury(&state->ally);
+    combat_bury(&state->enemy);
+}
+
+typedef struct Unit_Update_Job {
+    Game_State *state;
+    float dt;
+} Unit_Update_Job;
+
+void update_allies(void *data, int start, int end) {
+    Unit_Update_Job *job = (Unit_Update_Job *)data;
+    Army *ally = &job->state->ally;
+    Army *enemy = &job->state->enemy;
+    sys_trace_begin("update allies");
+
+    cooldowns_tick(ally, start, end, job->dt);
+
+    // drain only streams the resource column
+    if(job->state->resource_ticks >= RESOURCE_DRAIN_TIME) {
+        for(int i = start; i < end; i++) {
+            if(ally->resource[i] > 0) {
+                ally->resource[i] -= 1;
+            }
+        }
+    }
+
+    memcpy(ally->prev_x + start, ally->x + start, sizeof(float) * (size_t)(end - start));
+    memcpy(ally->prev_y + start, ally->y + start, sizeof(float) * (size_t)(end - start));
+    move_units(ally, start, end, job->dt);
+
+    // units that reached a waypoint head for the next one, the ones out of
+    // refined waypoints are left to the main thread
+    int stalled = 0;
+    for(int i = start; i < end; i++) {
+        if(ally->flags[i] & UNIT_FLAG_MOVING) {
+            continue;
+        }
+        if(ally->flags[i] & UNIT_FLAG_PATH) {
+            if(army_path_advance(ally, i)) {
+                ally->stalled[start + stalled++] = i;
+            }
+        } else if(ally->flags[i] & UNIT_FLAG_FLOW) {
+            flow_field_advance(&job->state->flow_fields, ally, i);
+        }
+    }
+    ally->stalled_count[start / ARMY_UPDATE_BATCH] = stalled;
+
+    // hit the closest enemy in reach, the enemy army is only read here
+    int events = 0;
+    for(int i = start; i < end; i++) {
+        if(ally->cooldown[COOLDOWN_ATTACK][i] > 0.0f) {
+            continue;
+        }
+        int t = army_nearest(enemy, ally->x[i], ally->y[i], ALLY_ATTACK_RANGE);
+        if(t >= 0) {
+            events = combat_strike(ally, i, enemy, t, ALLY_DAMAGE, ALLY_ATTACK_TIME, start, events);
+        }
+    }
+    ally->event_count[start / ARMY_UPDATE_BATCH] = events;
+
+    // relinking touches shared cell lists, so only record who changed cell
+    int moved = 0;
+    for(int i = start; i < end; i++) {
+        if(unit_cell(ally->x[i], ally->y[i]) != ally->cell[i]) {
+            ally->moved[start + moved++] = i;
+        }
+    }
+    ally->moved_count[start / ARMY_UPDATE_BATCH] = moved;
+    sys_trace_end();
+}
+
+//=============================================================================
+//
+//
+//  HORDE
+//
+//
+//=============================================================================
+// NOTE: pathing thousands of enemies every retarget would cost more than the
+// whole tick. the horde shares one field toward the closest ally, rebuilt
+// every ENEMY_FIELD_TIME, and only the last tiles to a target in sight are
+// walked in straight steps.
+
+// steps onto the neighbour tile toward (gx, gy), straight sides are tried
+// when the diagonal is blocked. 0 when every way is blocked. safe from the
+// update jobs, only touches unit i
+static inline int enemy_step(Map *map, Army *enemy, int i, float gx, float gy) {
+    float dx = gx - enemy->x[i];
+    float dy = gy - enemy->y[i];
+    int sx = (dx > 0.5f) - (dx < -0.5f);
+    int sy = (dy > 0.5f) - (dy < -0.5f);
+    int tx = unit_tile_coord(enemy->x[i]);
+    int ty = unit_tile_coord(enemy->y[i]);
+    int open_x = sx && map_walkable(map, tx + sx, ty, 0);
+    int open_y = sy && map_walkable(map, tx, ty + sy, 0);
+
+    // no corner cutting, same as the path finder
+    if(open_x && open_y && map_walkable(map, tx + sx, ty + sy, 0)) {
+        tx += sx;
+        ty += sy;
+    } else if(open_x && (!open_y || (dx > 0 ? dx : -dx) >= (dy > 0 ? dy : -dy))) {
+        tx += sx;
+    } else if(open_y) {
+        ty += sy;
+    } else {
+        return 0;
+    }
+    enemy->look_x[i] = (float)(tx - 1);
+    enemy->look_y[i] = (float)(ty - 1);
+    enemy->flags[i] |= UNIT_FLAG_MOVING;
+    return 1;
+}
+
+void update_enemies(void *data, int start, int end) {
+    Unit_Update_Job *job = (Unit_Update_Job *)data;
+    Game_State *state = job->state;
+    Army *enemy = &state->enemy;
+    Army *ally = &state->ally;
+    sys_trace_begin("update enemies");
+
+    cooldowns_tick(enemy, start, end, job->dt);
+
+    memcpy(enemy->prev_x + start, enemy->x + start, sizeof(float) * (size_t)(end - start));
+    memcpy(enemy->prev_y + start, enemy->y + start, sizeof(float) * (size_t)(end - start));
+    move_units(enemy, start, end, job->dt);
+
+    // NOTE: the ally army is read only here, it was stepped and relinked
+    // before the enemy jobs started
+    int events = 0;
+    for(int i = start; i < end; i++) {
+        if(enemy->cooldown[COOLDOWN_TARGET][i] <= 0.0f) {
+            int t = army_nearest(ally, enemy->x[i], enemy->y[i], ENEMY_SIGHT);
+            if(t >= 0) {
+                enemy->target[i] = army_handle(ally, t);
+            } else {
+                enemy->target[i].index = ARMY_NO_SLOT;
+            }
+            enemy->cooldown[COOLDOWN_TARGET][i] = ENEMY_TARGET_TIME;
+        }
+
+        int t = army_index(ally, enemy->target[i]);
+        if(t >= 0) {
+            float dx = ally->x[t] - enemy->x[i];
+            float dy = ally->y[t] - enemy->y[i];
+            if(dx * dx + dy * dy <= ENEMY_ATTACK_RANGE * ENEMY_ATTACK_RANGE) {
+                if(enemy->cooldown[COOLDOWN_ATTACK][i] <= 0.0f) {
+                    events = combat_strike(enemy, i, ally, t, ENEMY_DAMAGE, ENEMY_ATTACK_TIME, start, events);
+                }
+                continue;
+            }
+        }
+
+        if(enemy->flags[i] & UNIT_FLAG_MOVING) {
+            continue;
+        }
+        if(t >= 0 && enemy_step(&state->map, enemy, i, ally->x[t], ally->y[t])) {
+            continue;
+        }
+        if(enemy->flags[i] & UNIT_FLAG_FLOW) {
+            flow_field_advance(&state->horde_fields, enemy, i);
+        }
+    }
+    enemy->event_count[start / ARMY_UPDATE_BATCH] = events;
+
+    int moved = 0;
+    for(int i = start; i < end; i++) {
+        if(unit_cell(enemy->x[i], enemy->y[i]) != enemy->cell[i]) {
+            enemy->moved[start + moved++] = i;
+        }
+    }
+    enemy->moved_count[start / ARMY_UPDATE_BATCH] = moved;
+    sys_trace_end();
+}
+
+// tops the horde up to ENEMY_PER_ALLY per ally, a wave at a time. small
+// hordes trickle in, a big army is caught up with in a few waves
+void enemy_spawn_wave(Game_State *state) {
+    Army *ally = &state->ally;
+    Army *enemy = &state->enemy;
+    int missing = ally->count * ENEMY_PER_ALLY - enemy->count;
+    int wave = missing / ENEMY_SPAWN_SHARE > ENEMY_SPAWN_WAVE ? missing / ENEMY_SPAWN_SHARE : ENEMY_SPAWN_WAVE;
+    wave = wave < missing ? wave : missing;
+
+    for(int n = 0; n < wave; n++) {
+        int a = (int)sys_rand_range(&state->rand, (uint32_t)ally->count);
+        float angle = sys_rand_float(&state->rand) * 6.28318531f;
+        int tx = unit_tile_coord(ally->x[a] + cosf(angle) * ENEMY_SPAWN_DISTANCE);
+        int ty = unit_tile_coord(ally->y[a] + sinf(angle) * ENEMY_SPAWN_DISTANCE);
+        if(!map_walkable(&state->map, tx, ty, 0)) {
+            continue; // the next wave tries again
+        }
+        int e = army_index(enemy, army_spawn(enemy, UNIT_TYPE_ENEMY, (float)(tx - 1), (float)(ty - 1)));
+        // spread the nearest ally queries over the retarget period
+        enemy->cooldown[COOLDOWN_TARGET][e] = sys_rand_float(&state->rand) * ENEMY_TARGET_TIME;
+        if(state->horde_field >= 0) {
+            enemy->flow[e] = (uint32_t)state->horde_field;
+            enemy->flags[e] |= UNIT_FLAG_FLOW;
+        }
+    }
+}
+
+void simulate(Game_State *state, float dt) {
+    Army *ally = &state->ally;
+    Army *enemy = &state->enemy;
+
+    state->tick++;
+    state->resource_ticks += dt;
+
+    // UPDATE allied units
+    Unit_Update_Job job = { state, dt };
+    profile_begin("allies");
+    profile_units(ally->count);
+    Sys_Job_Counter counter = { 0 };
+    sys_job_parallel_for(update_allies, &job, ally->count, ARMY_UPDATE_BATCH, &counter);
+    sys_job_wait(&counter);
+
+    for(int start = 0; start < ally->count; start += ARMY_UPDATE_BATCH) {
+        for(int k = 0; k < ally->moved_count[start / ARMY_UPDATE_BATCH]; k++) {
+            army_grid_update(ally, ally->moved[start + k]);
+        }
+        for(int k = 0; k < ally->stalled_count[start / ARMY_UPDATE_BATCH]; k++) {
+            int i = ally->stalled[start + k];
+            army_path_refine(state, ally, i);
+            army_path_advance(ally, i);
+        }
+    }
+    profile_end();
+
+    // UPDATE enemy units
+    state->horde_field_time += dt;
+    if(state->horde_field_time >= ENEMY_FIELD_TIME && enemy->count) {
+        state->horde_field_time = 0.0f;
+        PROFILE_BLOCK("horde field") {
+            state->horde_field = flow_field_build_chase(&state->horde_fields, &state->map, enemy, ally);
+        }
+        for(int i = 0; i < enemy->count; i++) {
+            if(state->horde_field >= 0) {
+                enemy->flow[i] = (uint32_t)state->horde_field;
+                enemy->flags[i] |= UNIT_FLAG_FLOW;
+            } else {
+                enemy->flags[i] &= ~UNIT_FLAG_FLOW;
+            }
+        }
+    }
+
+    profile_begin("enemies");
+    profile_units(enemy->count);
+    Sys_Job_Counter enemy_counter = { 0 };
+    sys_job_parallel_for(update_enemies, &job, enemy->count, ARMY_UPDATE_BATCH, &enemy_counter);
+    sys_job_wait(&enemy_counter);
+
+    for(int start = 0; start < enemy->count; start += ARMY_UPDATE_BATCH) {
+        for(int k = 0; k < enemy->moved_count[start / ARMY_UPDATE_BATCH]; k++) {
+            army_grid_update(enemy, enemy->moved[start + k]);
+        }
+    }
+    profile_end();
+
+    // RESOLVE combat, after both armies queued their hits
+    PROFILE_BLOCK("combat") {
+        profile_units(ally->count + enemy->count);
+        combat_update(state);
+    }
+
+    state->enemy_spawn_time += dt;
+    if(state->enemy_spawn_time >= ENEMY_SPAWN_TIME) {
+        state->enemy_spawn_time = 0.0f;
+        PROFILE_BLOCK("spawn") {
+            enemy_spawn_wave(state);
+        }
+    }
+
+    // UPDATE tick timers
+    if(state->resource_ticks >= RESOURCE_DRAIN_TIME) { state->resource_ticks = 0.0f; }
+}
 
-    state->resource_ticks += sys->dt;
+// input is read once per frame, then the simulation catches up in fixed steps
+void update(Game_State *state, Sys_State *sys) {
+    Army *ally = &state->ally;
 
+    state->frame++;
+
+    profile_begin("input");
     if(sys_key_pressed(SYS_MOUSE_LEFT)) {
         state->mouse_pressed = vec2(sys->mouse.x, sys->mouse.y);
     }
@@ -283,25 +4729,19 @@ void loop(Sys_State *sys) {
         float box_top = (pressed_y <= released_y) ? pressed_y : released_y;
         float box_bottom = (pressed_y >= released_y) ? pressed_y : released_y;
 
-        state->selection_count = 0;
-
-        for(int i = 0; i < MAX_ARMY_SIZE; i++) {
-            if(state->ally[i].type > UNIT_TYPE_NONE) {
-                if(state->ally[i].x <= box_right && state->ally[i].x >= box_left && state->ally[i].y <= box_bottom && state->ally[i].y >= box_top) {
-                    state->selection[state->selection_count] = &state->ally[i];
-                    state->selection_count++;
-                }
-            }
-        }
+        selection_clear(state);
+        selection_add_rect(state, box_left, box_top, box_right, box_bottom);
  
     }
     if(sys_key_pressed(SYS_MOUSE_RIGHT)) {
         if(state->selection_count) {
+            float x = state->camera.x + ((int)sys->mouse.x * GRID_SIZE / sys->width);
+            float y = state->camera.y + ((int)sys->mouse.y * GRID_SIZE / sys->height);
+            selection_order_move(state, x, y);
             for(int i = 0; i < state->selection_count; i++) {
-                state->selection[i]->look_x = state->camera.x + ((int)sys->mouse.x * GRID_SIZE / sys->width);
-                state->selection[i]->look_y =  state->camera.y +((int)sys->mouse.y * GRID_SIZE / sys->height);
-                state->selection[i]->flags |= UNIT_FLAG_MOVING; 
-                state->selection[i]->animation_time = (float)sys_time_now();
+                int u = army_index(ally, state->selection[i]);
+                if(u < 0) { continue; }
+                ally->animation_time[u] = UNIT_ANIMATION_FRAME_TIME; // next frame on the next step
             }
         }
     }
@@ -320,187 +4760,154 @@ void loop(Sys_State *sys) {
     }
     
     if(sys_key_pressed(SYS_KEY_F2)) { // select all I guess?
-        state->selection_count = 0;
-       for(int i = 0; i < MAX_ARMY_SIZE; i++) {
-           if(state->ally[i].type > UNIT_TYPE_NONE) {
-               state->selection[state->selection_count] = &state->ally[i];
-               state->selection_count++;
-           }
-       }
+        selection_clear(state);
+        for(int i = 0; i < ally->count; i++) {
+            selection_add(state, army_handle(ally, i));
+        }
     }
     if(sys_key_pressed(SYS_KEY_F3)) { // select all on screen I guess?
-        state->selection_count = 0;
-        for(int i = 0; i < MAX_ARMY_SIZE; i++) {
-            if(state->ally[i].type > UNIT_TYPE_NONE) {
-                if(state->ally[i].x >= state->camera.x && state->ally[i].x <= state->camera.x + GRID_SIZE
-                   && state->ally[i].y >= state->camera.y && state->ally[i].y <= state->camera.y + GRID_SIZE) {
-                    state->selection[state->selection_count] = &state->ally[i];
-                    state->selection_count++; 
-                }
-            }
-        }
+        selection_clear(state);
+        selection_add_rect(state, state->camera.x, state->camera.y, state->camera.x + GRID_SIZE, state->camera.y + GRID_SIZE);
     }
     if(sys_key_pressed(SYS_KEY_ESC)) { // select none
-        state->selection_count = 0;
+        selection_clear(state);
     }
     if(sys_key_pressed('S')) { // stop 
         for(int i = 0; i < state->selection_count; i++) {
-            state->selection[i]->look_x = state->selection[i]->x;
-            state->selection[i]->look_y = state->selection[i]->y;
+            int u = army_index(ally, state->selection[i]);
+            if(u < 0) { continue; }
+            ally->look_x[u] = ally->x[u];
+            ally->look_y[u] = ally->y[u];
+            army_path_clear(ally, u);
         }
     }
     if(sys_key_pressed('D')) { // disperse
         for(int i = 0; i < state->selection_count; i++) {
-            state->selection[i]->look_x = rand() % GRID_SIZE + state->camera.x;
-            state->selection[i]->look_y = rand() % GRID_SIZE + state->camera.y;
-            state->selection[i]->flags |= UNIT_FLAG_MOVING;
+            int u = army_index(ally, state->selection[i]);
+            if(u < 0) { continue; }
+            float x = sys_rand_range(&state->rand, GRID_SIZE) + state->camera.x;
+            float y = sys_rand_range(&state->rand, GRID_SIZE) + state->camera.y;
+            army_order_move(state, ally, u, x, y);
         }
     }
 
     if(sys_key_pressed('E')) { // HARVEST / EAT
         for(int i = 0; i < state->selection_count; i++) {
-            int tx = (int)state->selection[i]->x+1;
-            int ty = (int)state->selection[i]->y+1;
-            if(state->tile[tx][ty].type > TILE_TYPE_GRASS && state->tile[tx][ty].resource > 0) {
-                state->tile[tx][ty].resource--;
-                state->selection[i]->resource++;
-                if(state->tile[tx][ty].resource == 0) {
-                    state->tile[tx][ty].type = TILE_TYPE_GRASS;
+            int u = army_index(ally, state->selection[i]);
+            if(u < 0) { continue; }
+            int tx = (int)ally->x[u]+1;
+            int ty = (int)ally->y[u]+1;
+            Tile tile = map_get(&state->map, tx, ty);
+            if(tile.type > TILE_TYPE_GRASS && tile.resource > 0) {
+                map_tile(&state->map, tx, ty)->resource--;
+                ally->resource[u]++;
+                if(tile.resource == 1) {
+                    map_set_type(&state->map, tx, ty, TILE_TYPE_GRASS);
                 }
             }
         }
     }
     if(sys_key_pressed('Q')) {
         for(int i = 0; i < state->selection_count; i++) {
-            if(state->selection[i]->resource >= UNIT_COST && state->ally_count < MAX_ARMY_SIZE) {
-                state->selection[i]->resource -= UNIT_COST;
-                state->ally[state->ally_count].type = state->selection[i]->type;
-                state->ally[state->ally_count].x = state->selection[i]->x;
-                state->ally[state->ally_count].y = state->selection[i]->y;
-                state->ally[state->ally_count].look_x = state->selection[i]->look_x;
-                state->ally[state->ally_count].look_y = state->selection[i]->look_y;
-                state->ally[state->ally_count].hp = START_HP;
-                state->ally[state->ally_count].resource = 0;
-                state->ally_count++;
+            int u = army_index(ally, state->selection[i]);
+            if(u < 0) { continue; }
+            if(ally->resource[u] >= UNIT_COST) {
+                ally->resource[u] -= UNIT_COST;
+                int n = army_index(ally, army_spawn(ally, ally->type[u], ally->x[u], ally->y[u]));
+                ally->look_x[n] = ally->look_x[u];
+                ally->look_y[n] = ally->look_y[u];
             }
         }
     }
 
-    // UPDATE allied units
-    for(int i = 0; i < MAX_ARMY_SIZE; i++) {
-        
-        if(state->resource_ticks >= RESOURCE_DRAIN_TIME && state->ally[i].resource > 0) {
-            state->ally[i].resource -= 1;
+    if(sys_key_pressed(SYS_KEY_F4)) { // profiler overlay
+        profiler.show = !profiler.show;
+    }
+    // NOTE: not while recording or replaying, a load would replay against
+    // whatever snapshot is around then and a save would clobber the player's
+    if(sys_key_pressed(SYS_KEY_F5) && replay.mode == REPLAY_OFF) { // quick save
+        PROFILE_BLOCK("snapshot save") {
+            snapshot_save(state, SNAPSHOT_FILE);
         }
-        if(state->ally[i].x < state->ally[i].look_x + 0.1f && state->ally[i].x > state->ally[i].look_x - 0.1f
-                && (state->ally[i].flags & UNIT_FLAG_MOVING) && state->ally[i].y < state->ally[i].look_y + 0.1f 
-                && state->ally[i].y > state->ally[i].look_y - 0.1f) {
-            state->ally[i].flags ^= UNIT_FLAG_MOVING;
-            state->ally[i].x = state->ally[i].look_x;
-            state->ally[i].y = state->ally[i].look_y;
-            state->ally[i].animation_frame = 0;
-            state->ally[i].animation_time = 0;
+    }
+    if(sys_key_pressed(SYS_KEY_F9) && replay.mode == REPLAY_OFF) { // quick load
+        PROFILE_BLOCK("snapshot load") {
+            snapshot_load(state, SNAPSHOT_FILE);
         }
+    }
+    profile_end();
 
-        if(state->ally[i].flags & UNIT_FLAG_MOVING) {
-
-            state->ally[i].animation_time += sys->dt;
-            if(state->ally[i].animation_time >= UNIT_ANIMATION_FRAME_TIME) {
-                state->ally[i].animation_frame = (state->ally[i].animation_frame + 1) % UNIT_ANIMATION_FRAMES;
-                state->ally[i].animation_time = 0;
-            }
+    state->sim_accumulator += sys->dt;
+    if(state->sim_accumulator > SIM_MAX_STEPS * SIM_DT) {
+        state->sim_accumulator = SIM_MAX_STEPS * SIM_DT;
+    }
+    while(state->sim_accumulator >= SIM_DT) {
+        PROFILE_BLOCK("simulate") {
+            simulate(state, SIM_DT);
+        }
+        state->sim_accumulator -= SIM_DT;
+    }
+    state->sim_alpha = state->sim_accumulator / SIM_DT;
+}
 
-            float dx = 0.0f;
-            float dy = 0.0f;
+#ifndef SYS_HEADLESS
+// pushes every unit of the army that is on screen
+static void draw_army(Game_State *state, Army *army, Sprite_Batch *batch) {
+    uint32_t columns = (uint32_t)(state->sprite_sheet.width / SPRITE_SIZE);
+    // NOTE: a unit moves less than a tile per step so the cells one tile
+    // around the view hold everything interpolated into it
+    int cx0 = unit_cell_coord(state->camera.x - 1);
+    int cy0 = unit_cell_coord(state->camera.y - 1);
+    int cx1 = unit_cell_coord(state->camera.x + GRID_SIZE + 1);
+    int cy1 = unit_cell_coord(state->camera.y + GRID_SIZE + 1);
 
-            if(state->ally[i].x < state->ally[i].look_x - 0.1f) {
-                dx = sys->dt * UNIT_TILES_PER_SECOND;
-            } else if(state->ally[i].x > state->ally[i].look_x + 0.1f) {
-                dx = -1.0f * sys->dt * UNIT_TILES_PER_SECOND; 
-            }
+    for(int cy = cy0; cy <= cy1; cy++) {
+        for(int cx = cx0; cx <= cx1; cx++) {
+            uint32_t slot = army->cell_head[cy * UNIT_CELLS_PER_ROW + cx];
+            while(slot != ARMY_NO_SLOT) {
+                int i = (int)army->slot_dense[slot];
+                float x = army->prev_x[i] + (army->x[i] - army->prev_x[i]) * state->sim_alpha;
+                float y = army->prev_y[i] + (army->y[i] - army->prev_y[i]) * state->sim_alpha;
+                int map_x = (int)x;
+                int map_y = (int)y;
 
-            if(state->ally[i].y < state->ally[i].look_y - 0.1f) {
-                dy = sys->dt * UNIT_TILES_PER_SECOND;
-            } else if(state->ally[i].y > state->ally[i].look_y + 0.1f) {
-               dy = -1.0f * sys->dt * UNIT_TILES_PER_SECOND;
+                if(map_x >= state->camera.x && map_x <= state->camera.x + GRID_SIZE
+                   && map_y >= state->camera.y && map_y <= state->camera.y + GRID_SIZE) {
+                    uint32_t row = columns - army->type[i];
+                    sprite_batch_push(batch, x, y, row * columns + army->animation_frame[i]);
+                }
+                slot = army->slot_next[slot];
             }
-
-            state->ally[i].x += dx;
-            state->ally[i].y += dy;
         }
     }
+}
 
-    // UPDATE tick timers
-    if(state->resource_ticks >= RESOURCE_DRAIN_TIME) { state->resource_ticks = 0.0f; }
+void draw(Game_State *state, Sys_State *sys) {
+    init_gl(sys->width, sys->height); 
 
     // DRAW map
-    float render_size = 1.0f/ GRID_SIZE;
-    float tile_size = 1.0f / state->sprite_sheet.width * SPRITE_SIZE;
-
-    // NOTE(rayalan): the camera position is the top left most square
-    glBindTexture(GL_TEXTURE_2D, state->sprite_sheet.id);
-    glColor3f(color_white);
-    glPushMatrix();
-        glLoadIdentity();
-        glOrtho(0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f);
-        glBegin(GL_QUADS);
-            for(int i = 1; i <= GRID_SIZE; i++) {
-                for(int j = 1; j <= GRID_SIZE; j++) {
-                    int tx = i + state->camera.x;
-                    int ty = j + state->camera.y;
-                    // what texture index is at tile
-                    // TODO(rayalan): this you should just feed this an index
-                    //      what it should support any index in the sprite sheet
-                    int t = state->tile[tx][ty].type;
-                    glTexCoord2f(t * tile_size, 0.0f);
-                    glVertex2f((i-1)*render_size, j*render_size);
-                    glTexCoord2f((t+1) * tile_size, 0);
-                    glVertex2f(i*render_size, j*render_size);
-                    glTexCoord2f((t+1) * tile_size, tile_size);
-                    glVertex2f(i*render_size, (j-1)*render_size);
-                    glTexCoord2f(t * tile_size, tile_size);
-                    glVertex2f((i-1)*render_size, (j-1)*render_size);        
-                }
-            }
-    glEnd();
-    glPopMatrix();
-    glBindTexture(GL_TEXTURE_2D, 0);
+    PROFILE_BLOCK("map") {
+        draw_map(state);
+    }
 
+    // DRAW units
+    profile_begin("units");
+    Sprite_Batch *batch = &state->sprite_batch;
+    sprite_batch_begin(batch);
+    draw_army(state, &state->ally, batch);
+    draw_army(state, &state->enemy, batch);
+    profile_units(batch->count);
 
-    // DRAW allied units
     glBindTexture(GL_TEXTURE_2D, state->sprite_sheet.id);
-
     glColor3f(color_white);
     glPushMatrix();
-    {
         glLoadIdentity();
-        glOrtho(0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f);
-        glBegin(GL_QUADS);
-            for(int i = 0; i < state->ally_count; i++) {
-                int map_x = (int)state->ally[i].x;
-                int map_y = (int)state->ally[i].y;
-
-                if(map_x >= state->camera.x && map_x <= state->camera.x + GRID_SIZE
-                   && map_y >= state->camera.y && map_y <= state->camera.y + GRID_SIZE) {
-                    
-                    float draw_x = state->ally[i].x - state->camera.x;
-                    float  draw_y = state->ally[i].y - state->camera.y;
-                    int tx = state->ally[i].animation_frame;
-                    int ty = state->sprite_sheet.width / SPRITE_SIZE - state->ally[i].type + 1;
-                    glTexCoord2f(tx * tile_size, (ty-1) * tile_size);
-                    glVertex2f(draw_x * render_size, (draw_y+1) * render_size);
-                    glTexCoord2f((tx+1) * tile_size, (ty-1) * tile_size);
-                    glVertex2f((draw_x+1) * render_size, (draw_y+1) * render_size);
-                    glTexCoord2f((tx+1) * tile_size, ty * tile_size);
-                    glVertex2f((draw_x+1) * render_size, draw_y * render_size);
-                    glTexCoord2f(tx * tile_size, ty * tile_size);
-                    glVertex2f(draw_x * render_size, draw_y * render_size);
-                }
-            }
-        glEnd();
-    }
+        glOrtho(0.0f, GRID_SIZE, GRID_SIZE, 0.0f, 0.0f, 1.0f);
+        glTranslatef(-state->camera.x, -state->camera.y, 0.0f);
+        sprite_batch_flush(batch, &state->sprite_sheet);
     glPopMatrix();
     glBindTexture(GL_TEXTURE_2D, 0);
+    profile_end();
 
 
     // DRAW UI
@@ -521,24 +4928,78 @@ void loop(Sys_State *sys) {
     uint64_t total_hp = 0;
     uint64_t total_resource = 0;
 
-    for(int i = 0; i < state->ally_count; i++) {
-        total_hp += state->ally[i].hp;
-        total_resource += state->ally[i].resource;
+    for(int i = 0; i < state->ally.count; i++) {
+        total_hp += state->ally.hp[i];
+    }
+    for(int i = 0; i < state->ally.count; i++) {
+        total_resource += state->ally.resource[i];
     }
 
     char hp_buf[64], res_buf[64];
-    sprintf(hp_buf, "%lld", total_hp);
-    sprintf(res_buf, "%lld", total_resource);
+    sprintf(hp_buf, "%" PRIu64, total_hp);
+    sprintf(res_buf, "%" PRIu64, total_resource);
 
     glColor3f(color_white);
     right_string((float)sys->width - 32.0f, sys->height * 0.02f, 2.0f, hp_buf);
     right_string((float)sys->width - 32.0f, sys->height * 0.05f, 2.0f, res_buf);
+
+    if(profiler.show) {
+        draw_profiler(sys);
+    }
+}
+#endif /* SYS_HEADLESS */
+
+void loop(Sys_State *sys) {
+    Game_State *state = (Game_State *)sys->memory.ptr;
+    if(!replay_frame(sys)) {
+#ifdef SYS_HEADLESS
+        sys_quit();
+        return;
+#endif
+    }
+    profile_frame_begin();
+    PROFILE_BLOCK("update") {
+        update(state, sys);
+    }
+#ifdef SYS_HEADLESS
+    if(state->frame_limit && state->frame >= state->frame_limit) {
+        sys_quit();
+    }
+#else
+    PROFILE_BLOCK("draw") {
+        draw(state, sys);
+    }
+#endif
+    profile_frame_end();
 }
 
 
 
 void quit(Sys_State *sys) {
     // NOTE(rayalan): idk if I want the user to be require to do this for sys.h
+    Game_State *state = (Game_State *)sys->memory.ptr;
+    profile_report(stdout);
+    profile_begin("quit");
+    replay_stop();
+#ifndef SYS_HEADLESS
+    tile_renderer_free(&state->tile_renderer);
+    sprite_batch_free(&state->sprite_batch);
+#endif
+    map_free(&state->map);
+    path_finder_free(&state->path_finder);
+    path_graph_free(&state->path_graph);
+    flow_fields_free(&state->flow_fields);
+    flow_fields_free(&state->horde_fields);
+    army_free(&state->ally);
+    army_free(&state->enemy);
+    if(state->selection_memory.ptr) {
+        sys_free(state->selection_memory);
+    }
+    profile_end();
+#ifdef GAME_TRACE
+    sys_trace_stop();
+#endif
+    sys_job_shutdown();
     sys_free(sys->memory);
     fclose(stdout);
 }
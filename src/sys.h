@@ -2,19 +2,16 @@
 // this library is too wip for documentation
 // c99 features used in this library
 // TODO(rayalan): 
-//  use bit manipulation to cut down keyboard input size
 //  load dlls/*.so
 //	system info
 //		ram
 //		cpu info / features (simd / etc)
 //		display names / etc
 //		peripheral names/etc
-//	threads / job api
 //  mutexes
 //  atomics
 //  semaphores
 //	osx
-//	linux
 #ifndef SYS_INCLUDE
 #define SYS_INCLUDE
 #ifdef __cplusplus
@@ -38,6 +35,8 @@ extern "C" {
 	#define SYS_OSX
 #elif defined(__linux__)
 	#define SYS_LINUX
+	#include <pthread.h>
+	#include <semaphore.h>
 #else
 	#error "You must #define what system you are building for."
 #endif
@@ -81,8 +80,20 @@ extern "C" {
 #endif
 
 #define SYS_MONITOR_PRIMARY -1
-#define SYS_INPUT_STATE_SIZE 512
-#define SYS_INPUT_STATE_USED 256
+#define SYS_KEY_COUNT 256
+#define SYS_KEY_WORDS (SYS_KEY_COUNT / 64)
+
+// index of the lowest set bit, bits can't be 0. walks a word of keys
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	static __inline int sys_lowest_bit(uint64_t bits) {
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return (int)index;
+	}
+#else
+	#define sys_lowest_bit(bits) __builtin_ctzll(bits)
+#endif
 
 #ifndef SYS_OPENGL_MAJOR
 #define SYS_OPENGL_MAJOR 4
@@ -91,6 +102,13 @@ extern "C" {
 #define SYS_OPENGL_MINOR 1
 #endif
 
+// NOTE: SYS_HEADLESS builds without a window, gl context or input devices.
+// SYS_LOOP_PROC is stepped with a fixed dt as fast as the cpu allows until
+// sys_quit() is called.
+#ifndef SYS_HEADLESS_DT
+#define SYS_HEADLESS_DT (1.0f / 60.0f)
+#endif
+
 #ifndef SYS_OPENGL_COLOR_BITS
 #define SYS_OPENGL_COLOR_BITS 32
 #endif
@@ -286,18 +304,57 @@ typedef struct Sys_File {
 	uint64_t size;
 } Sys_File;
 
+#define SYS_FILE_MAP_READ 0x0 // read only
+#define SYS_FILE_MAP_COPY 0x1 // writable, writes stay private to the process
+
+typedef struct Sys_File_View {
+	void *ptr; // the first byte asked for
+	uint64_t size;
+	void *base; // start of the mapping, aligned down from ptr
+	size_t base_size;
+} Sys_File_View;
+
 typedef struct Sys_Mutex {
 #ifdef SYS_WINDOWS
     CRITICAL_SECTION section;
 #endif /* SYS_WINDOWS */
+#ifdef SYS_LINUX
+	pthread_mutex_t mutex;
+#endif /* SYS_LINUX */
 } Sys_Mutex;
 
 typedef struct Sys_Semaphore {
 #ifdef SYS_WINDOWS
 	void *ptr;
 #endif /* SYS_WINDOWS */
+#ifdef SYS_LINUX
+	sem_t sem;
+#endif /* SYS_LINUX */
 } Sys_Semaphore;
 
+typedef int sys_thread_proc(void *data);
+
+typedef struct Sys_Thread {
+	void *ptr;
+	sys_thread_proc *proc;
+	void *data;
+} Sys_Thread;
+
+// a job runs proc over the index range [start, end)
+typedef void sys_job_proc(void *data, int start, int end);
+
+// counts the jobs submitted against it that have not finished yet
+typedef struct Sys_Job_Counter {
+	volatile int32_t value;
+} Sys_Job_Counter;
+
+#ifndef SYS_JOB_QUEUE_SIZE
+#define SYS_JOB_QUEUE_SIZE 1024 // per thread, must be a power of two
+#endif
+#ifndef SYS_MAX_THREADS
+#define SYS_MAX_THREADS 64
+#endif
+
 typedef struct Sys_Config {
 	int width, height;
 	int monitor;
@@ -307,9 +364,10 @@ typedef struct Sys_Config {
 	unsigned char color_bits, depth_bits;
 } Sys_Config;
 
+// pcg32, every stream is an independent sequence for the same seed
 typedef struct Sys_Rand {
-	uint32_t state;
-	uint64_t step;
+	uint64_t state;
+	uint64_t step; // stream increment, always odd
 } Sys_Rand;
 
 typedef struct Sys_State {
@@ -326,7 +384,9 @@ typedef struct Sys_State {
 		int x, y;
 		int dx, dy, dw;
 	} mouse;
-	unsigned char input_state[SYS_INPUT_STATE_SIZE];
+	// one bit per key code, keys is this frame and prev_keys the last one
+	uint64_t keys[SYS_KEY_WORDS];
+	uint64_t prev_keys[SYS_KEY_WORDS];
 	// timing
 	float dt;
 	// system
@@ -346,17 +406,37 @@ SYS_DEF void sys_toggle_fullscreen(void);
 SYS_DEF void sys_quit(void);
 
 SYS_DEF double sys_time_now(void);
+// raw high resolution counter, sys_time_frequency ticks per second
+SYS_DEF uint64_t sys_time_ticks(void);
+SYS_DEF uint64_t sys_time_frequency(void);
 SYS_DEF void sys_sleep(int ms);
 
+// opengl entry points past 1.1, 0 when the driver doesn't have them
+SYS_DEF void *sys_gl_proc(const char *name);
+
 SYS_DEF Sys_File sys_file_open(const char *file_name);
+// opens a file that already exists for reading, ptr is 0 when it doesn't
+SYS_DEF Sys_File sys_file_open_read(const char *file_name);
 SYS_DEF void sys_file_close(Sys_File file);
 SYS_DEF uint64_t sys_file_read(Sys_File file, uint64_t offset, uint64_t size, void *destination);
 SYS_DEF uint64_t sys_file_write(Sys_File file, uint64_t offset, uint64_t size, void *source);
+// grows with zeros or cuts the file to size bytes
+SYS_DEF void sys_file_set_size(Sys_File *file, uint64_t size);
+// maps size bytes from offset, 0 maps to the end of the file. any offset
+// works and the view outlives the file handle. ptr is 0 for an empty view
+SYS_DEF Sys_File_View sys_file_map(Sys_File file, uint64_t offset, uint64_t size, int flags);
+SYS_DEF void sys_file_unmap(Sys_File_View view);
+// moves a closed file over another in one step, 0 when it couldn't
+SYS_DEF int sys_file_replace(const char *from, const char *to);
 
 // TODO(rayalan): more virtual memory work
 // TODO(rayalan): make these thread safe using critical sections
 SYS_DEF Sys_Memory sys_alloc(size_t size, uint64_t flags);
 SYS_DEF void sys_free(Sys_Memory memory);
+// bytes sys_alloc holds right now and the most it held since the last reset
+SYS_DEF uint64_t sys_memory_used(void);
+SYS_DEF uint64_t sys_memory_peak(void);
+SYS_DEF void sys_memory_reset_peak(void);
 
 // mutex
 SYS_DEF inline void sys_mutex_init(Sys_Mutex *mutex);
@@ -372,28 +452,73 @@ SYS_DEF inline void sys_semaphore_wait(Sys_Semaphore *semaphore);
 SYS_DEF inline void sys_semaphore_destroy(Sys_Semaphore *semaphore);
 
 // atomic operations
-// TODO(rayalan): the returns on these are wrong
+// TODO(rayalan): inc/dec/sub return nothing and the cas calls do not report
+// whether the swap happened
+// the adds return the value from before the add
 SYS_DEF void sys_atomic32_inc(volatile int32_t *atomic);
 SYS_DEF void sys_atomic32_dec(volatile int32_t *atomic);
-SYS_DEF void sys_atomic32_add(volatile int32_t *atomic, int32_t by);
+SYS_DEF int32_t sys_atomic32_add(volatile int32_t *atomic, int32_t by);
 SYS_DEF void sys_atomic32_sub(volatile int32_t *atomic, int32_t by);
 SYS_DEF void sys_atomic32_cas(volatile int32_t *dest, int32_t old_value, int32_t new_value);
 
 SYS_DEF void sys_atomic64_inc(volatile int64_t *atomic);
 SYS_DEF void sys_atomic64_dec(volatile int64_t *atomic);
-SYS_DEF void sys_atomic64_add(volatile int64_t *atomic, int64_t by);
+SYS_DEF int64_t sys_atomic64_add(volatile int64_t *atomic, int64_t by);
 SYS_DEF void sys_atomic64_sub(volatile int64_t *atomic, int64_t by);
 SYS_DEF void sys_atomic64_cas(volatile int64_t *dest, int64_t old_value, int64_t new_value);
 
 SYS_DEF void sys_atomic_cas_ptr(void * volatile *dest, void *old_value, void *new_value);
+SYS_DEF void sys_memory_barrier(void);
+
+// threads
+SYS_DEF int sys_cpu_count(void);
+SYS_DEF void sys_thread_create(Sys_Thread *thread, sys_thread_proc *proc, void *data);
+SYS_DEF void sys_thread_join(Sys_Thread *thread);
+
+// jobs
+// thread_count workers are started next to the calling thread, 0 uses one per
+// extra core. every thread owns a queue and steals from the others when empty.
+// sys_job_wait runs queued jobs on the calling thread until the counter hits 0.
+SYS_DEF void sys_job_init(int thread_count);
+SYS_DEF void sys_job_shutdown(void);
+SYS_DEF int sys_job_thread_count(void);
+SYS_DEF void sys_job_submit(sys_job_proc *proc, void *data, int start, int end, Sys_Job_Counter *counter);
+SYS_DEF void sys_job_parallel_for(sys_job_proc *proc, void *data, int count, int batch_size, Sys_Job_Counter *counter);
+SYS_DEF void sys_job_wait(Sys_Job_Counter *counter);
+
+// random
+// sys_rand_advance jumps delta numbers ahead in O(log delta)
+SYS_DEF void sys_rand_seed(Sys_Rand *rand, uint64_t seed, uint64_t stream);
+SYS_DEF uint32_t sys_rand_next(Sys_Rand *rand);
+SYS_DEF uint32_t sys_rand_range(Sys_Rand *rand, uint32_t bound);
+SYS_DEF float sys_rand_float(Sys_Rand *rand);
+SYS_DEF void sys_rand_advance(Sys_Rand *rand, uint64_t delta);
+
+// trace
+// begin/end events in the chrome trace format, for chrome://tracing or
+// perfetto. every thread records into its own buffer and writes it out at
+// its own reserved offset in the file when it fills up, no locks are taken.
+// sys_alloc, sys_free and the file calls are traced while a trace runs.
+// call sys_trace_stop with the job threads idle, names aren't escaped
+SYS_DEF void sys_trace_start(const char *file_name);
+SYS_DEF void sys_trace_stop(void);
+SYS_DEF void sys_trace_begin(const char *name);
+SYS_DEF void sys_trace_end(void);
 
 // input 
 SYS_DEF inline unsigned char sys_key_pressed(const unsigned char key);
 SYS_DEF inline unsigned char sys_key_released(const unsigned char key);
 SYS_DEF inline unsigned char sys_key_down(const unsigned char key);
+SYS_DEF inline void sys_key_set(const unsigned char key, int down);
+// fills changed with keys ^ prev_keys, returns 0 when nothing changed
+SYS_DEF int sys_keys_changed(uint64_t changed[SYS_KEY_WORDS]);
 
 
+#ifndef SYS_INIT_PROC
 static Sys_Config sys_default_config(void);
+#endif
+static void sys_input_advance(void);
+static void sys_memory_track(int64_t bytes);
 #ifdef SYS_INIT_PROC
 Sys_Config SYS_INIT_PROC(int argc, char **argv);
 #endif
@@ -416,6 +541,12 @@ void SYS_QUIT_PROC(Sys_State *sys);
 
 #ifdef SYS_IMPLEMENTATION
 #define SYS_IMPLEMENTATION
+#include <string.h> // memcpy, memset
+
+#ifdef SYS_HEADLESS
+#include <stdio.h> // fprintf
+#undef SYS_OPENGL
+#endif /* SYS_HEADLESS */
 
 #ifdef SYS_WINDOWS
 
@@ -465,6 +596,7 @@ SYS_DEF Sys_Memory sys_alloc(size_t size, uint64_t flags) {
 	Sys_Memory memory = { 0 };
 	MEMORY_BASIC_INFORMATION info = { 0 };
 	memory.flags = flags;
+	sys_trace_begin("sys_alloc");
 
 #ifdef SYS_DEBUG
 	 const size_t alloc_size = size + 8192;
@@ -488,11 +620,14 @@ SYS_DEF Sys_Memory sys_alloc(size_t size, uint64_t flags) {
 	memory.ptr = (void*)(p + 4096);
 #endif
 	
+	sys_memory_track((int64_t)memory.alloc_size);
+	sys_trace_end();
 	return memory;
 }
 
 SYS_DEF void sys_free(Sys_Memory memory) {
 	// todo(rayalan): asserts
+	sys_trace_begin("sys_free");
 #ifdef SYS_DEBUG
 	unsigned char *p = (unsigned char *)memory.ptr;
 	sys_assert(p);
@@ -500,10 +635,13 @@ SYS_DEF void sys_free(Sys_Memory memory) {
 #else
 	VirtualFree(memory.ptr, memory.alloc_size, MEM_RELEASE);
 #endif
+	sys_memory_track(-(int64_t)memory.alloc_size);
+	sys_trace_end();
 }
 
 SYS_DEF Sys_File sys_file_open(const char* file_name) {
 	Sys_File file = { 0 };
+	sys_trace_begin("sys_file_open");
 	HANDLE handle = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_ALWAYS, 0, 0);
 	if (handle != INVALID_HANDLE_VALUE) {
 		LARGE_INTEGER size = { 0 };
@@ -518,13 +656,42 @@ SYS_DEF Sys_File sys_file_open(const char* file_name) {
 	} else {
 		sys_error("Failed to open file.");
 	}
+	sys_trace_end();
+	return file;
+}
+
+SYS_DEF Sys_File sys_file_open_read(const char* file_name) {
+	Sys_File file = { 0 };
+	sys_trace_begin("sys_file_open_read");
+	HANDLE handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, 0, 0);
+	if (handle != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER size = { 0 };
+		if (!GetFileSizeEx(handle, &size)) {
+			sys_error("Failed to determine file size.");
+		}
+		file.ptr = handle;
+		file.size = (uint64_t)size.QuadPart;
+	}
+	sys_trace_end();
 	return file;
 }
 
 SYS_DEF void sys_file_close(Sys_File file) {
+	sys_trace_begin("sys_file_close");
 	if (!CloseHandle(file.ptr)) {
 		sys_error("Failed to close file.");
 	}
+	sys_trace_end();
+}
+
+SYS_DEF void sys_file_set_size(Sys_File *file, uint64_t size) {
+	LARGE_INTEGER end;
+	end.QuadPart = (LONGLONG)size;
+	if (!SetFilePointerEx(file->ptr, end, 0, FILE_BEGIN) || !SetEndOfFile(file->ptr)) {
+		sys_error("Failed to resize file.");
+		return;
+	}
+	file->size = size;
 }
 
 SYS_DEF uint64_t sys_file_read(Sys_File file, uint64_t offset, uint64_t size, void *destination) {
@@ -536,12 +703,14 @@ SYS_DEF uint64_t sys_file_read(Sys_File file, uint64_t offset, uint64_t size, vo
 	if (size > 0xFFFFFFFF) {
 		sys_error("Exceded Win32 max read size of 4 GB.");
 	}
+	sys_trace_begin("sys_file_read");
 	if (!ReadFile(file.ptr, destination, (uint32_t)size, &bytes_read, &overlapped)) {
 		sys_error("Unable to read file");
 	}
 	if (bytes_read != size) {
 		sys_error("Unable to read indicated number of bytes from file.");
 	}
+	sys_trace_end();
 
 	return (uint64_t)bytes_read;
 }
@@ -555,17 +724,64 @@ SYS_DEF uint64_t sys_file_write(Sys_File file, uint64_t offset, uint64_t size, v
 	if (size > 0xFFFFFFFF) {
 		sys_error("Exceded Win32 max write size of 4 GB");
 	}
+	sys_trace_begin("sys_file_write");
 	if (!WriteFile(file.ptr, source, (uint32_t)size, &bytes_written, &overlapped)) {
 		sys_error("Unable to write file");
 	}
 	if (bytes_written != size) {
 		sys_error("Unable to write indicated number of bytes to file.");
 	}
+	sys_trace_end();
 
 	return (uint64_t)bytes_written;
 }
 
-// TODO(rayalan): job system, semaphores, memory barriers
+SYS_DEF Sys_File_View sys_file_map(Sys_File file, uint64_t offset, uint64_t size, int flags) {
+	Sys_File_View view = { 0 };
+	if (!size) {
+		size = offset < file.size ? file.size - offset : 0;
+	}
+	if (!size || offset + size > file.size) {
+		return view;
+	}
+	sys_trace_begin("sys_file_map");
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	uint64_t base_offset = offset - offset % info.dwAllocationGranularity;
+	HANDLE mapping = CreateFileMappingA(file.ptr, 0, (flags & SYS_FILE_MAP_COPY) ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0);
+	if (mapping) {
+		view.base_size = (size_t)(offset - base_offset + size);
+		view.base = MapViewOfFile(mapping, (flags & SYS_FILE_MAP_COPY) ? FILE_MAP_COPY : FILE_MAP_READ,
+		                          (DWORD)(base_offset >> 32), (DWORD)(base_offset & 0xFFFFFFFF), view.base_size);
+		// NOTE: the view keeps the mapping object alive
+		CloseHandle(mapping);
+	}
+	if (view.base) {
+		view.ptr = (unsigned char *)view.base + (offset - base_offset);
+		view.size = size;
+	} else {
+		sys_error("Failed to map file.");
+		view.base_size = 0;
+	}
+	sys_trace_end();
+	return view;
+}
+
+SYS_DEF void sys_file_unmap(Sys_File_View view) {
+	if (view.base) {
+		sys_trace_begin("sys_file_unmap");
+		UnmapViewOfFile(view.base);
+		sys_trace_end();
+	}
+}
+
+SYS_DEF int sys_file_replace(const char *from, const char *to) {
+	sys_trace_begin("sys_file_replace");
+	int ok = MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+	sys_trace_end();
+	return ok;
+}
+
 SYS_DEF inline void sys_mutex_init(Sys_Mutex *mutex) {
     InitializeCriticalSection(&mutex->section);
 }
@@ -587,7 +803,7 @@ SYS_DEF inline void sys_mutex_destroy(Sys_Mutex *mutex) {
 }
 
 SYS_DEF inline void sys_semaphore_init(Sys_Semaphore *semaphore, uint32_t initial_value) {
-    semaphore->ptr = CreateSemaphore(NULL, (long)initial_value, 0xFFFFFFFF, NULL);
+    semaphore->ptr = CreateSemaphore(NULL, (long)initial_value, 0x7FFFFFFF, NULL);
 }
 
 
@@ -611,8 +827,8 @@ SYS_DEF inline void sys_atomic32_dec(volatile int32_t *atomic) {
     InterlockedDecrement((volatile long *)atomic);
 }
 
-SYS_DEF inline void sys_atomic32_add(volatile int32_t *atomic, int32_t by) {
-    InterlockedExchangeAdd((volatile long *)atomic, (long)by); 
+SYS_DEF inline int32_t sys_atomic32_add(volatile int32_t *atomic, int32_t by) {
+    return (int32_t)InterlockedExchangeAdd((volatile long *)atomic, (long)by); 
 }
 
 SYS_DEF inline void sys_atomic32_sub(volatile int32_t *atomic, int32_t by) {
@@ -631,8 +847,8 @@ SYS_DEF inline void sys_atomic64_dec(volatile int64_t *atomic) {
     InterlockedDecrement64(atomic);
 }
 
-SYS_DEF inline void sys_atomic64_add(volatile int64_t *atomic, int64_t by) {
-    InterlockedExchangeAdd64(atomic, by);
+SYS_DEF inline int64_t sys_atomic64_add(volatile int64_t *atomic, int64_t by) {
+    return InterlockedExchangeAdd64(atomic, by);
 }
 
 SYS_DEF inline void sys_atomic64_sub(volatile int64_t *atomic, int64_t by) {
@@ -647,6 +863,36 @@ SYS_DEF inline void sys_atomic_cas_ptr(void * volatile *dest, void *old_value, v
 	InterlockedCompareExchangePointer(dest, new_value, old_value);
 }
 
+SYS_DEF inline void sys_memory_barrier(void) {
+	MemoryBarrier();
+}
+
+SYS_DEF int sys_cpu_count(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+static DWORD __stdcall sys_thread_start(void *data) {
+	Sys_Thread *thread = (Sys_Thread *)data;
+	return (DWORD)thread->proc(thread->data);
+}
+
+SYS_DEF void sys_thread_create(Sys_Thread *thread, sys_thread_proc *proc, void *data) {
+	thread->proc = proc;
+	thread->data = data;
+	thread->ptr = CreateThread(0, 0, sys_thread_start, thread, 0, 0);
+	if (!thread->ptr) {
+		sys_error("Failed to create thread.");
+	}
+}
+
+SYS_DEF void sys_thread_join(Sys_Thread *thread) {
+	WaitForSingleObject(thread->ptr, INFINITE);
+	CloseHandle(thread->ptr);
+	thread->ptr = 0;
+}
+
 SYS_DEF void sys_sleep(int ms) {
 	Sleep((DWORD)ms);
 }
@@ -663,15 +909,30 @@ SYS_DEF double sys_time_now(void) {
 	return (double)now.QuadPart / freq.QuadPart;
 }
 
+SYS_DEF uint64_t sys_time_ticks(void) {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (uint64_t)now.QuadPart;
+}
+
+SYS_DEF uint64_t sys_time_frequency(void) {
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)freq.QuadPart;
+}
+
+#ifndef SYS_HEADLESS
 SYS_DEF void sys_message_box(const char *title, const char *message) {
 	MessageBoxA((HWND)__sys_state.window, message, title, MB_OK);
 }
+#endif /* SYS_HEADLESS */
 
 SYS_DEF void sys_error(const char *message) {
 	sys_message_box("Error", message);
 	sys_quit();
 }
 
+#ifndef SYS_HEADLESS
 static void sys_update_window(LPRECT rect) {
 	if(__sys_state.fullscreen) {
 		LONG style = GetWindowLong((HWND)__sys_state.window, GWL_STYLE);
@@ -789,6 +1050,20 @@ static void sys_create_gl_context(void) {
 #endif /* SYS_OPENGL */
 }
 
+SYS_DEF void *sys_gl_proc(const char *name) {
+#ifdef SYS_OPENGL
+	void *proc = (void *)wglGetProcAddress(name);
+	// NOTE: some drivers hand back small integers instead of 0 on failure
+	if (proc == 0 || proc == (void *)1 || proc == (void *)2 || proc == (void *)3 || proc == (void *)-1) {
+		proc = (void *)GetProcAddress(GetModuleHandleA("opengl32.dll"), name);
+	}
+	return proc;
+#else
+	sys_unused(name);
+	return 0;
+#endif /* SYS_OPENGL */
+}
+
 LRESULT __stdcall sys_win_proc(HWND window, UINT message, WPARAM wparam, LPARAM lparam) {
   switch(message) {
         case WM_CLOSE: {
@@ -819,7 +1094,7 @@ LRESULT __stdcall sys_win_proc(HWND window, UINT message, WPARAM wparam, LPARAM
 			__sys_state.focused = 1; 
 		} break;
 		case WM_KILLFOCUS: {
-			ZeroMemory(__sys_state.input_state, SYS_INPUT_STATE_SIZE);
+			ZeroMemory(__sys_state.keys, sizeof(__sys_state.keys));
 			__sys_state.focused = 0;
 		} break;
 		case WM_INPUT: {
@@ -834,52 +1109,52 @@ LRESULT __stdcall sys_win_proc(HWND window, UINT message, WPARAM wparam, LPARAM
 				int flags = buffer.data.mouse.usButtonFlags;
 
 				if (flags & RI_MOUSE_LEFT_BUTTON_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_LEFT] = 1;
+					sys_key_set(SYS_MOUSE_LEFT, 1);
 				}
 				else if (flags & RI_MOUSE_LEFT_BUTTON_UP) {
-					__sys_state.input_state[SYS_MOUSE_LEFT] = 0;
+					sys_key_set(SYS_MOUSE_LEFT, 0);
 				}
 				else if (flags & RI_MOUSE_MIDDLE_BUTTON_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_MIDDLE] = 1;
+					sys_key_set(SYS_MOUSE_MIDDLE, 1);
 				}
 				else if (flags & RI_MOUSE_MIDDLE_BUTTON_UP) {
-					__sys_state.input_state[SYS_MOUSE_MIDDLE] = 0;
+					sys_key_set(SYS_MOUSE_MIDDLE, 0);
 				}
 				else if (flags & RI_MOUSE_RIGHT_BUTTON_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_RIGHT] = 1;
+					sys_key_set(SYS_MOUSE_RIGHT, 1);
 				}
 				else if (flags & RI_MOUSE_RIGHT_BUTTON_UP) {
-					__sys_state.input_state[SYS_MOUSE_RIGHT] = 0;
+					sys_key_set(SYS_MOUSE_RIGHT, 0);
 				}
 				else if (flags & RI_MOUSE_BUTTON_1_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON1] = 1;
+					sys_key_set(SYS_MOUSE_BUTTON1, 1);
 				}
 				else if (flags & RI_MOUSE_BUTTON_1_UP) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON1] = 0;
+					sys_key_set(SYS_MOUSE_BUTTON1, 0);
 				}
 				else if (flags & RI_MOUSE_BUTTON_2_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON2] = 1;
+					sys_key_set(SYS_MOUSE_BUTTON2, 1);
 				}
 				else if (flags & RI_MOUSE_BUTTON_2_UP) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON2] = 0;
+					sys_key_set(SYS_MOUSE_BUTTON2, 0);
 				}
 				else if (flags & RI_MOUSE_BUTTON_3_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON3] = 1;
+					sys_key_set(SYS_MOUSE_BUTTON3, 1);
 				}
 				else if (flags & RI_MOUSE_BUTTON_3_UP) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON3] = 0;
+					sys_key_set(SYS_MOUSE_BUTTON3, 0);
 				}
 				else if (flags & RI_MOUSE_BUTTON_4_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON4] = 1;
+					sys_key_set(SYS_MOUSE_BUTTON4, 1);
 				}
 				else if (flags & RI_MOUSE_BUTTON_4_UP) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON4] = 0;
+					sys_key_set(SYS_MOUSE_BUTTON4, 0);
 				}
 				else if (flags & RI_MOUSE_BUTTON_5_DOWN) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON5] = 1;
+					sys_key_set(SYS_MOUSE_BUTTON5, 1);
 				}
 				else if (flags & RI_MOUSE_BUTTON_5_UP) {
-					__sys_state.input_state[SYS_MOUSE_BUTTON5] = 0;
+					sys_key_set(SYS_MOUSE_BUTTON5, 0);
 				}
 				else if (flags & RI_MOUSE_WHEEL) {
 					__sys_state.mouse.dw += (short)buffer.data.mouse.usButtonData / 120;
@@ -949,12 +1224,12 @@ LRESULT __stdcall sys_win_proc(HWND window, UINT message, WPARAM wparam, LPARAM
 
 #ifndef SYS_NO_ALT_ENTER
 				if (virtual_key == SYS_KEY_ENTER) {
-					if (__sys_state.input_state[SYS_KEY_ALT] && !__sys_state.input_state[SYS_KEY_ENTER] &&
+					if (sys_key_down(SYS_KEY_ALT) && !sys_key_down(SYS_KEY_ENTER) &&
 						((flags & RI_KEY_BREAK) == 0))
 						sys_toggle_fullscreen();
 				}
 #endif
-				__sys_state.input_state[virtual_key] = (unsigned char)!(flags & RI_KEY_BREAK);
+				sys_key_set((unsigned char)virtual_key, !(flags & RI_KEY_BREAK));
 			} 
 
 		} break;
@@ -1126,9 +1401,7 @@ int __stdcall WinMain(HINSTANCE instance, HINSTANCE prev, char *cmd_line, int sh
 #ifdef SYS_LOOP_PROC
 		SYS_LOOP_PROC(&__sys_state);
 #endif
-        // TODO(rayalan): waste of mmeory, bit flags weren't working
-        // TODO(rayalan): get that working
-		CopyMemory(__sys_state.input_state + SYS_INPUT_STATE_USED, __sys_state.input_state, SYS_INPUT_STATE_USED);
+		sys_input_advance();
 
 		HDC device_context = GetDC((HWND)__sys_state.window);
 		SwapBuffers(device_context);
@@ -1175,6 +1448,7 @@ SYS_DEF void sys_toggle_fullscreen(void) {
                  SWP_NOOWNERZORDER | SWP_FRAMECHANGED);
   }
 }
+#endif /* SYS_HEADLESS */
 
 SYS_DEF void sys_quit(void) {
 	__sys_state.running = 0;
@@ -1182,26 +1456,1444 @@ SYS_DEF void sys_quit(void) {
 
 #endif /* SYS_WINDOWS */
 
-static Sys_Config sys_default_config(void) {
-	Sys_Config default_config = { 0 };
-	default_config.width = 1280;
-	default_config.height = 720;
-	default_config.monitor = SYS_MONITOR_PRIMARY;
-	default_config.fullscreen = 0;
-	default_config.title = "What a Wonderful World!";
-	return default_config;
+#ifdef SYS_LINUX
+#include <stdio.h> // fprintf
+#include <errno.h>
+#include <time.h> // clock_gettime, nanosleep
+#include <fcntl.h>
+#include <unistd.h> // pread, pwrite, sysconf
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef SYS_HEADLESS
+#include <dlfcn.h> // libXrandr is optional, it's looked up at runtime
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+
+// the part of Xrandr.h sys_set_window_params needs, XRRGetMonitors is randr 1.5
+typedef struct Sys_XRR_Monitor_Info {
+	Atom name;
+	Bool primary;
+	Bool automatic;
+	int noutput;
+	int x, y;
+	int width, height;
+	int mwidth, mheight;
+	XID *outputs;
+} Sys_XRR_Monitor_Info;
+
+typedef Sys_XRR_Monitor_Info *xrr_get_monitors(Display *display, Window window, Bool get_active, int *count);
+typedef void xrr_free_monitors(Sys_XRR_Monitor_Info *monitors);
+
+#ifdef SYS_OPENGL
+#include <GL/gl.h>
+#include <GL/glx.h>
+
+#ifndef GLX_ARB_create_context
+#define GLX_ARB_create_context
+#define GLX_CONTEXT_MAJOR_VERSION_ARB     0x2091
+#define GLX_CONTEXT_MINOR_VERSION_ARB     0x2092
+#define GLX_CONTEXT_FLAGS_ARB             0x2094
+#define GLX_CONTEXT_DEBUG_BIT_ARB         0x00000001
+#define GLX_CONTEXT_PROFILE_MASK_ARB      0x9126
+#define GLX_CONTEXT_CORE_PROFILE_BIT_ARB  0x00000001
+#define GLX_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB 0x00000002
+#endif /* GLX_ARB_create_context */
+
+typedef GLXContext glx_create_context_attribs_arb(Display *display,
+                                                  GLXFBConfig config,
+                                                  GLXContext share_context,
+                                                  Bool direct,
+                                                  const int *attribList);
+typedef void glx_swap_interval_ext(Display *display, GLXDrawable drawable, int interval);
+
+#ifdef SYS_OPENGL_COMPATIBILITY
+#define SYS_OPENGL_PROFILE GLX_CONTEXT_COMPATIBILITY_PROFILE_BIT_ARB
+#else
+#define SYS_OPENGL_PROFILE GLX_CONTEXT_CORE_PROFILE_BIT_ARB
+#endif /* SYS_OPENGL_COMPATIBILITY */
+#endif /* SYS_OPENGL */
+#endif /* SYS_HEADLESS */
+
+SYS_DEF Sys_Memory sys_alloc(size_t size, uint64_t flags) {
+	Sys_Memory memory = { 0 };
+	const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+	memory.flags = flags;
+	sys_trace_begin("sys_alloc");
+
+#ifdef SYS_DEBUG
+	const size_t alloc_size = ((size + page_size - 1) / page_size) * page_size + 2 * page_size;
+#else
+	const size_t alloc_size = ((size + page_size - 1) / page_size) * page_size;
+#endif
+
+	memory.ptr = mmap(0, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory.ptr == MAP_FAILED) {
+		memory.ptr = 0;
+	}
+	sys_assert(memory.ptr);
+
+	memory.alloc_size = alloc_size;
+	memory.usable_size = alloc_size;
+
+#ifdef SYS_DEBUG
+	unsigned char *p = (unsigned char *)memory.ptr;
+	mprotect(p, page_size, PROT_NONE);
+	mprotect(p + memory.alloc_size - page_size, page_size, PROT_NONE);
+	memory.usable_size = memory.alloc_size - 2 * page_size;
+	memory.ptr = (void*)(p + page_size);
+#endif
+
+	sys_memory_track((int64_t)memory.alloc_size);
+	sys_trace_end();
+	return memory;
 }
 
-inline unsigned char sys_key_pressed(const unsigned char key) {
-	return (unsigned char)(__sys_state.input_state[key] && (__sys_state.input_state[key] != __sys_state.input_state[key+SYS_INPUT_STATE_USED]));
+SYS_DEF void sys_free(Sys_Memory memory) {
+	sys_trace_begin("sys_free");
+#ifdef SYS_DEBUG
+	unsigned char *p = (unsigned char *)memory.ptr;
+	sys_assert(p);
+	munmap(p - (size_t)sysconf(_SC_PAGESIZE), memory.alloc_size);
+#else
+	munmap(memory.ptr, memory.alloc_size);
+#endif
+	sys_memory_track(-(int64_t)memory.alloc_size);
+	sys_trace_end();
 }
 
-inline unsigned char sys_key_released(const unsigned char key) {
-	return (unsigned char)(!__sys_state.input_state[key] && (__sys_state.input_state[key] != __sys_state.input_state[key+SYS_INPUT_STATE_USED]));
+SYS_DEF Sys_File sys_file_open(const char* file_name) {
+	Sys_File file = { 0 };
+	sys_trace_begin("sys_file_open");
+	int fd = open(file_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd != -1) {
+		file.is_new = 1;
+	} else if (errno == EEXIST) {
+		fd = open(file_name, O_RDWR);
+	}
+
+	if (fd != -1) {
+		struct stat info;
+		if (fstat(fd, &info) == -1) {
+			sys_error("Failed to determine file size.");
+		}
+
+		file.ptr = (void *)(intptr_t)fd;
+		file.size = (uint64_t)info.st_size;
+	} else {
+		sys_error("Failed to open file.");
+	}
+	sys_trace_end();
+	return file;
 }
 
-inline unsigned char sys_key_down(const unsigned char key) {
-	return __sys_state.input_state[key];
+SYS_DEF Sys_File sys_file_open_read(const char* file_name) {
+	Sys_File file = { 0 };
+	sys_trace_begin("sys_file_open_read");
+	int fd = open(file_name, O_RDONLY);
+	if (fd != -1) {
+		struct stat info;
+		if (fstat(fd, &info) == -1) {
+			sys_error("Failed to determine file size.");
+		}
+		file.ptr = (void *)(intptr_t)fd;
+		file.size = (uint64_t)info.st_size;
+	}
+	sys_trace_end();
+	return file;
+}
+
+SYS_DEF void sys_file_close(Sys_File file) {
+	sys_trace_begin("sys_file_close");
+	if (close((int)(intptr_t)file.ptr) == -1) {
+		sys_error("Failed to close file.");
+	}
+	sys_trace_end();
+}
+
+SYS_DEF void sys_file_set_size(Sys_File *file, uint64_t size) {
+	if (ftruncate((int)(intptr_t)file->ptr, (off_t)size) == -1) {
+		sys_error("Failed to resize file.");
+		return;
+	}
+	file->size = size;
+}
+
+SYS_DEF uint64_t sys_file_read(Sys_File file, uint64_t offset, uint64_t size, void *destination) {
+	uint64_t bytes_read = 0;
+	unsigned char *dest = (unsigned char *)destination;
+	sys_trace_begin("sys_file_read");
+
+	while (bytes_read < size) {
+		ssize_t result = pread((int)(intptr_t)file.ptr, dest + bytes_read, (size_t)(size - bytes_read), (off_t)(offset + bytes_read));
+		if (result == -1 && errno == EINTR) {
+			continue;
+		}
+		if (result == -1) {
+			sys_error("Unable to read file");
+			break;
+		}
+		if (result == 0) {
+			break;
+		}
+		bytes_read += (uint64_t)result;
+	}
+	if (bytes_read != size) {
+		sys_error("Unable to read indicated number of bytes from file.");
+	}
+	sys_trace_end();
+
+	return bytes_read;
+}
+
+SYS_DEF uint64_t sys_file_write(Sys_File file, uint64_t offset, uint64_t size, void *source) {
+	uint64_t bytes_written = 0;
+	unsigned char *src = (unsigned char *)source;
+	sys_trace_begin("sys_file_write");
+
+	while (bytes_written < size) {
+		ssize_t result = pwrite((int)(intptr_t)file.ptr, src + bytes_written, (size_t)(size - bytes_written), (off_t)(offset + bytes_written));
+		if (result == -1 && errno == EINTR) {
+			continue;
+		}
+		if (result <= 0) {
+			sys_error("Unable to write file");
+			break;
+		}
+		bytes_written += (uint64_t)result;
+	}
+	if (bytes_written != size) {
+		sys_error("Unable to write indicated number of bytes to file.");
+	}
+	sys_trace_end();
+
+	return bytes_written;
+}
+
+SYS_DEF Sys_File_View sys_file_map(Sys_File file, uint64_t offset, uint64_t size, int flags) {
+	Sys_File_View view = { 0 };
+	if (!size) {
+		size = offset < file.size ? file.size - offset : 0;
+	}
+	if (!size || offset + size > file.size) {
+		return view;
+	}
+	sys_trace_begin("sys_file_map");
+	uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+	uint64_t base_offset = offset - offset % page_size;
+	view.base_size = (size_t)(offset - base_offset + size);
+	view.base = mmap(0, view.base_size, (flags & SYS_FILE_MAP_COPY) ? PROT_READ | PROT_WRITE : PROT_READ,
+	                 MAP_PRIVATE, (int)(intptr_t)file.ptr, (off_t)base_offset);
+	if (view.base != MAP_FAILED) {
+		view.ptr = (unsigned char *)view.base + (offset - base_offset);
+		view.size = size;
+	} else {
+		sys_error("Failed to map file.");
+		view.base = 0;
+		view.base_size = 0;
+	}
+	sys_trace_end();
+	return view;
+}
+
+SYS_DEF void sys_file_unmap(Sys_File_View view) {
+	if (view.base) {
+		sys_trace_begin("sys_file_unmap");
+		munmap(view.base, view.base_size);
+		sys_trace_end();
+	}
+}
+
+SYS_DEF int sys_file_replace(const char *from, const char *to) {
+	sys_trace_begin("sys_file_replace");
+	int ok = rename(from, to) == 0;
+	sys_trace_end();
+	return ok;
+}
+
+SYS_DEF inline void sys_mutex_init(Sys_Mutex *mutex) {
+	pthread_mutex_init(&mutex->mutex, NULL);
+}
+
+SYS_DEF inline void sys_mutex_lock(Sys_Mutex *mutex) {
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+SYS_DEF inline int sys_mutex_try_lock(Sys_Mutex *mutex) {
+	return pthread_mutex_trylock(&mutex->mutex) == 0;
+}
+
+SYS_DEF inline void sys_mutex_unlock(Sys_Mutex *mutex) {
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+SYS_DEF inline void sys_mutex_destroy(Sys_Mutex *mutex) {
+	pthread_mutex_destroy(&mutex->mutex);
+}
+
+// NOTE: glibc semaphores are futex backed, they only enter the kernel when
+// a thread actually has to sleep
+SYS_DEF inline void sys_semaphore_init(Sys_Semaphore *semaphore, uint32_t initial_value) {
+	sem_init(&semaphore->sem, 0, initial_value);
+}
+
+SYS_DEF inline void sys_semaphore_signal(Sys_Semaphore *semaphore) {
+	sem_post(&semaphore->sem);
+}
+
+SYS_DEF inline void sys_semaphore_wait(Sys_Semaphore *semaphore) {
+	while (sem_wait(&semaphore->sem) == -1 && errno == EINTR) {}
+}
+
+SYS_DEF inline void sys_semaphore_destroy(Sys_Semaphore *semaphore) {
+	sem_destroy(&semaphore->sem);
+}
+
+SYS_DEF inline void sys_atomic32_inc(volatile int32_t *atomic) {
+	__sync_fetch_and_add(atomic, 1);
+}
+
+SYS_DEF inline void sys_atomic32_dec(volatile int32_t *atomic) {
+	__sync_fetch_and_sub(atomic, 1);
+}
+
+SYS_DEF inline int32_t sys_atomic32_add(volatile int32_t *atomic, int32_t by) {
+	return __sync_fetch_and_add(atomic, by);
+}
+
+SYS_DEF inline void sys_atomic32_sub(volatile int32_t *atomic, int32_t by) {
+	__sync_fetch_and_sub(atomic, by);
+}
+
+SYS_DEF inline void sys_atomic32_cas(volatile int32_t *dest, int32_t old_value, int32_t new_value) {
+	(void)__sync_val_compare_and_swap(dest, old_value, new_value);
+}
+
+SYS_DEF inline void sys_atomic64_inc(volatile int64_t *atomic) {
+	__sync_fetch_and_add(atomic, 1);
+}
+
+SYS_DEF inline void sys_atomic64_dec(volatile int64_t *atomic) {
+	__sync_fetch_and_sub(atomic, 1);
+}
+
+SYS_DEF inline int64_t sys_atomic64_add(volatile int64_t *atomic, int64_t by) {
+	return __sync_fetch_and_add(atomic, by);
+}
+
+SYS_DEF inline void sys_atomic64_sub(volatile int64_t *atomic, int64_t by) {
+	__sync_fetch_and_sub(atomic, by);
+}
+
+SYS_DEF inline void sys_atomic64_cas(volatile int64_t *dest, int64_t old_value, int64_t new_value) {
+	(void)__sync_val_compare_and_swap(dest, old_value, new_value);
+}
+
+SYS_DEF inline void sys_atomic_cas_ptr(void * volatile *dest, void *old_value, void *new_value) {
+	(void)__sync_val_compare_and_swap(dest, old_value, new_value);
+}
+
+SYS_DEF inline void sys_memory_barrier(void) {
+	__sync_synchronize();
+}
+
+SYS_DEF int sys_cpu_count(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+}
+
+static void *sys_thread_start(void *data) {
+	Sys_Thread *thread = (Sys_Thread *)data;
+	return (void *)(intptr_t)thread->proc(thread->data);
+}
+
+SYS_DEF void sys_thread_create(Sys_Thread *thread, sys_thread_proc *proc, void *data) {
+	pthread_t handle;
+	thread->proc = proc;
+	thread->data = data;
+	if (pthread_create(&handle, NULL, sys_thread_start, thread) != 0) {
+		sys_error("Failed to create thread.");
+	}
+	thread->ptr = (void *)(uintptr_t)handle;
+}
+
+SYS_DEF void sys_thread_join(Sys_Thread *thread) {
+	pthread_join((pthread_t)(uintptr_t)thread->ptr, NULL);
+	thread->ptr = 0;
+}
+
+SYS_DEF void sys_sleep(int ms) {
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+}
+
+SYS_DEF double sys_time_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+SYS_DEF uint64_t sys_time_ticks(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+SYS_DEF uint64_t sys_time_frequency(void) {
+	return 1000000000ULL;
+}
+
+#ifndef SYS_HEADLESS
+static Display *__sys_display;
+static Atom __sys_wm_delete_window;
+
+#define SYS_MESSAGE_BOX_PADDING 16
+
+// a plain window with the message, any key, click or close dismisses it.
+// stderr gets a copy for when there is no display or no one watching it
+SYS_DEF void sys_message_box(const char *title, const char *message) {
+	fprintf(stderr, "%s: %s\n", title, message);
+	if (!__sys_display) {
+		return;
+	}
+
+	Display *display = __sys_display;
+	int screen = DefaultScreen(display);
+	XFontStruct *font = XLoadQueryFont(display, "fixed");
+	int line_height = font ? font->ascent + font->descent : 13;
+	int ascent = font ? font->ascent : 10;
+	int lines = 0;
+	int text_width = 0;
+	for (const char *line = message; line; lines++) {
+		const char *end = strchr(line, '\n');
+		int length = end ? (int)(end - line) : (int)strlen(line);
+		int width = font ? XTextWidth(font, line, length) : length * 6;
+		text_width = width > text_width ? width : text_width;
+		line = end ? end + 1 : 0;
+	}
+
+	int width = text_width + 2 * SYS_MESSAGE_BOX_PADDING;
+	int height = lines * line_height + 2 * SYS_MESSAGE_BOX_PADDING;
+	width = width < 200 ? 200 : width;
+	Window box = XCreateSimpleWindow(display, RootWindow(display, screen),
+	                                 (DisplayWidth(display, screen) - width) / 2,
+	                                 (DisplayHeight(display, screen) - height) / 2,
+	                                 (unsigned int)width, (unsigned int)height, 1,
+	                                 BlackPixel(display, screen), WhitePixel(display, screen));
+	Atom delete_window = XInternAtom(display, "WM_DELETE_WINDOW", False);
+	XSetWMProtocols(display, box, &delete_window, 1);
+	XStoreName(display, box, title);
+	XSelectInput(display, box, ExposureMask | KeyPressMask | ButtonPressMask);
+	GC gc = XCreateGC(display, box, 0, 0);
+	XSetForeground(display, gc, BlackPixel(display, screen));
+	if (font) {
+		XSetFont(display, gc, font->fid);
+	}
+	XMapRaised(display, box);
+
+	// NOTE: events for the game window that arrive meanwhile are dropped
+	for (int open = 1; open;) {
+		XEvent event;
+		XNextEvent(display, &event);
+		if (event.xany.window != box) {
+			continue;
+		}
+		switch (event.type) {
+			case Expose: {
+				if (event.xexpose.count) { break; }
+				const char *line = message;
+				for (int i = 0; line; i++) {
+					const char *end = strchr(line, '\n');
+					int length = end ? (int)(end - line) : (int)strlen(line);
+					XDrawString(display, box, gc, SYS_MESSAGE_BOX_PADDING,
+					            SYS_MESSAGE_BOX_PADDING + i * line_height + ascent, line, length);
+					line = end ? end + 1 : 0;
+				}
+			} break;
+			case KeyPress:
+			case ButtonPress: {
+				open = 0;
+			} break;
+			case ClientMessage: {
+				open = (Atom)event.xclient.data.l[0] != delete_window;
+			} break;
+		}
+	}
+
+	XFreeGC(display, gc);
+	XDestroyWindow(display, box);
+	if (font) {
+		XFreeFont(display, font);
+	}
+	XFlush(display);
+}
+
+static void sys_set_fullscreen(int fullscreen) {
+	XEvent event = { 0 };
+	event.xclient.type = ClientMessage;
+	event.xclient.window = (Window)__sys_state.window;
+	event.xclient.message_type = XInternAtom(__sys_display, "_NET_WM_STATE", False);
+	event.xclient.format = 32;
+	event.xclient.data.l[0] = fullscreen ? 1 : 0; // _NET_WM_STATE_ADD / _REMOVE
+	event.xclient.data.l[1] = (long)XInternAtom(__sys_display, "_NET_WM_STATE_FULLSCREEN", False);
+	event.xclient.data.l[2] = 0;
+	event.xclient.data.l[3] = 1;
+	XSendEvent(__sys_display, DefaultRootWindow(__sys_display), False,
+	           SubstructureRedirectMask | SubstructureNotifyMask, &event);
+	XFlush(__sys_display);
+}
+
+// finds monitor (or the primary one) through libXrandr when the system has
+// it, without it the whole screen counts as the one monitor
+static int sys_monitor_rect(int monitor, int *x, int *y, int *width, int *height) {
+	int screen = DefaultScreen(__sys_display);
+	*x = 0;
+	*y = 0;
+	*width = DisplayWidth(__sys_display, screen);
+	*height = DisplayHeight(__sys_display, screen);
+
+	static void *xrandr;
+	static int xrandr_tried;
+	if (!xrandr_tried) {
+		xrandr_tried = 1;
+		xrandr = dlopen("libXrandr.so.2", RTLD_LAZY | RTLD_LOCAL);
+	}
+	xrr_get_monitors *get_monitors = xrandr ? (xrr_get_monitors *)dlsym(xrandr, "XRRGetMonitors") : 0;
+	xrr_free_monitors *free_monitors = xrandr ? (xrr_free_monitors *)dlsym(xrandr, "XRRFreeMonitors") : 0;
+	if (!get_monitors || !free_monitors) {
+		return 0;
+	}
+
+	int count = 0;
+	Sys_XRR_Monitor_Info *monitors = get_monitors(__sys_display, RootWindow(__sys_display, screen), True, &count);
+	int found = -1;
+	for (int i = 0; i < count && found < 0; i++) {
+		if (monitor == SYS_MONITOR_PRIMARY ? monitors[i].primary : i == monitor) {
+			found = i;
+		}
+	}
+	if (found < 0 && count) {
+		found = 0; // no primary set or past the last monitor
+	}
+	if (found >= 0) {
+		*x = monitors[found].x;
+		*y = monitors[found].y;
+		*width = monitors[found].width;
+		*height = monitors[found].height;
+	}
+	if (monitors) {
+		free_monitors(monitors);
+	}
+	return found < 0 ? 0 : found;
+}
+
+SYS_DEF void sys_set_window_params(int width, int height, int monitor, int fullscreen) {
+	int monitor_x, monitor_y, monitor_width, monitor_height;
+	__sys_state.width = width;
+	__sys_state.height = height;
+	__sys_state.monitor = sys_monitor_rect(monitor, &monitor_x, &monitor_y, &monitor_width, &monitor_height);
+
+	XMoveResizeWindow(__sys_display, (Window)__sys_state.window,
+	                  monitor_x + (monitor_width - width) / 2, monitor_y + (monitor_height - height) / 2,
+	                  (unsigned int)width, (unsigned int)height);
+	if (__sys_state.fullscreen != fullscreen) {
+		sys_set_fullscreen(fullscreen);
+	}
+	__sys_state.fullscreen = fullscreen;
+}
+
+SYS_DEF void sys_show_cursor(int show) {
+	if (show) {
+		XUndefineCursor(__sys_display, (Window)__sys_state.window);
+	} else {
+		static char blank[8] = { 0 };
+		XColor black = { 0 };
+		Pixmap bitmap = XCreateBitmapFromData(__sys_display, (Window)__sys_state.window, blank, 8, 8);
+		Cursor cursor = XCreatePixmapCursor(__sys_display, bitmap, bitmap, &black, &black, 0, 0);
+		XDefineCursor(__sys_display, (Window)__sys_state.window, cursor);
+		XFreeCursor(__sys_display, cursor);
+		XFreePixmap(__sys_display, bitmap);
+	}
+}
+
+SYS_DEF void sys_set_title(const char *title) {
+	XStoreName(__sys_display, (Window)__sys_state.window, title);
+}
+
+SYS_DEF void sys_toggle_fullscreen(void) {
+	__sys_state.fullscreen = !__sys_state.fullscreen;
+	sys_set_fullscreen(__sys_state.fullscreen);
+}
+
+// maps X11 keysyms onto the windows virtual key codes used by SYS_KEY_*
+static unsigned char sys_translate_key(KeySym key) {
+	if (key >= XK_a && key <= XK_z) { return (unsigned char)('A' + (key - XK_a)); }
+	if (key >= XK_A && key <= XK_Z) { return (unsigned char)('A' + (key - XK_A)); }
+	if (key >= XK_0 && key <= XK_9) { return (unsigned char)('0' + (key - XK_0)); }
+	if (key >= XK_F1 && key <= XK_F24) { return (unsigned char)(SYS_KEY_F1 + (key - XK_F1)); }
+	if (key >= XK_KP_0 && key <= XK_KP_9) { return (unsigned char)(SYS_KEY_NUMPAD0 + (key - XK_KP_0)); }
+
+	switch (key) {
+		case XK_BackSpace: return SYS_KEY_BACKSPACE;
+		case XK_Tab: return SYS_KEY_TAB;
+		case XK_Clear: return SYS_KEY_CLEAR;
+		case XK_Return: return SYS_KEY_ENTER;
+		case XK_KP_Enter: return SYS_KEY_NUMENTER;
+		case XK_Shift_L: return SYS_KEY_SHIFT;
+		case XK_Shift_R: return SYS_KEY_SHIFT;
+		case XK_Control_L: return SYS_KEY_CONTROL;
+		case XK_Control_R: return SYS_KEY_CONTROL;
+		case XK_Alt_L: return SYS_KEY_ALT;
+		case XK_Alt_R: return SYS_KEY_ALT;
+		case XK_Pause: return SYS_KEY_PAUSE;
+		case XK_Caps_Lock: return SYS_KEY_CAPITAL;
+		case XK_Escape: return SYS_KEY_ESC;
+		case XK_space: return SYS_KEY_SPACE;
+		case XK_Page_Up: return SYS_KEY_PAGE_UP;
+		case XK_Page_Down: return SYS_KEY_PAGE_DOWN;
+		case XK_End: return SYS_KEY_END;
+		case XK_Home: return SYS_KEY_HOME;
+		case XK_Left: return SYS_KEY_LEFT;
+		case XK_Up: return SYS_KEY_UP;
+		case XK_Right: return SYS_KEY_RIGHT;
+		case XK_Down: return SYS_KEY_DOWN;
+		case XK_Select: return SYS_KEY_SELECT;
+		case XK_Print: return SYS_KEY_SNAPSHOT;
+		case XK_Insert: return SYS_KEY_INS;
+		case XK_Delete: return SYS_KEY_DELETE;
+		case XK_Help: return SYS_KEY_HELP;
+		case XK_Super_L: return SYS_KEY_LSUPER;
+		case XK_Super_R: return SYS_KEY_RSUPER;
+		case XK_Menu: return SYS_KEY_APPS;
+		case XK_KP_Multiply: return SYS_KEY_MULTIPLY;
+		case XK_KP_Add: return SYS_KEY_ADD;
+		case XK_KP_Separator: return SYS_KEY_SEPARATOR;
+		case XK_KP_Subtract: return SYS_KEY_SUBTRACT;
+		case XK_KP_Decimal: return SYS_KEY_DECIMAL;
+		case XK_KP_Divide: return SYS_KEY_DIVIDE;
+		case XK_Num_Lock: return SYS_KEY_NUMLOCK;
+		case XK_Scroll_Lock: return SYS_KEY_SCROLL;
+		case XK_semicolon: return SYS_KEY_SEMICOLON;
+		case XK_colon: return SYS_KEY_SEMICOLON;
+		case XK_equal: return SYS_KEY_PLUS;
+		case XK_plus: return SYS_KEY_PLUS;
+		case XK_comma: return SYS_KEY_COMMA;
+		case XK_less: return SYS_KEY_COMMA;
+		case XK_minus: return SYS_KEY_MINUS;
+		case XK_underscore: return SYS_KEY_MINUS;
+		case XK_period: return SYS_KEY_PERIOD;
+		case XK_greater: return SYS_KEY_PERIOD;
+		case XK_slash: return SYS_KEY_FORWARD_SLASH;
+		case XK_question: return SYS_KEY_FORWARD_SLASH;
+		case XK_grave: return SYS_KEY_TILDE;
+		case XK_asciitilde: return SYS_KEY_TILDE;
+		case XK_bracketleft: return SYS_KEY_LEFT_BRACE;
+		case XK_braceleft: return SYS_KEY_LEFT_BRACE;
+		case XK_backslash: return SYS_KEY_BACK_FLASH;
+		case XK_bar: return SYS_KEY_BACK_FLASH;
+		case XK_bracketright: return SYS_KEY_RIGHT_BRACE;
+		case XK_braceright: return SYS_KEY_RIGHT_BRACE;
+		case XK_apostrophe: return SYS_KEY_QUOTATION_MARK;
+		case XK_quotedbl: return SYS_KEY_QUOTATION_MARK;
+	}
+	return 0;
+}
+
+#ifdef SYS_OPENGL
+static GLXFBConfig __sys_fb_config;
+#endif
+
+// the visual to create the window with, the gl context can only be made
+// current on a window whose visual matches its framebuffer config. 0 keeps
+// the parent's, free the result with XFree
+static XVisualInfo *sys_choose_visual(void) {
+#ifdef SYS_OPENGL
+	int screen = DefaultScreen(__sys_display);
+	int visual_attribs[] = {
+		GLX_X_RENDERABLE, True,
+		GLX_DRAWABLE_TYPE, GLX_WINDOW_BIT,
+		GLX_RENDER_TYPE, GLX_RGBA_BIT,
+		GLX_BUFFER_SIZE, SYS_OPENGL_COLOR_BITS,
+		GLX_DEPTH_SIZE, SYS_OPENGL_DEPTH_BITS > 24 ? 24 : SYS_OPENGL_DEPTH_BITS,
+		GLX_DOUBLEBUFFER, True,
+		None
+	};
+
+	int config_count = 0;
+	GLXFBConfig *configs = glXChooseFBConfig(__sys_display, screen, visual_attribs, &config_count);
+	if (!configs || !config_count) {
+		sys_error("Failed to find a matching framebuffer config.");
+		return 0;
+	}
+	__sys_fb_config = configs[0];
+	XFree(configs);
+	return glXGetVisualFromFBConfig(__sys_display, __sys_fb_config);
+#else
+	return 0;
+#endif /* SYS_OPENGL */
+}
+
+static void sys_create_gl_context(void) {
+#ifdef SYS_OPENGL
+	GLXFBConfig config = __sys_fb_config;
+	if (!config) {
+		return;
+	}
+
+	glx_create_context_attribs_arb *__glXCreateContextAttribsARB =
+		(glx_create_context_attribs_arb *)
+		glXGetProcAddressARB((const GLubyte *)"glXCreateContextAttribsARB");
+
+	if (__glXCreateContextAttribsARB) {
+		int attribs[] = {
+			GLX_CONTEXT_MAJOR_VERSION_ARB, SYS_OPENGL_MAJOR,
+			GLX_CONTEXT_MINOR_VERSION_ARB, SYS_OPENGL_MINOR,
+#ifdef SYS_DEBUG
+			GLX_CONTEXT_FLAGS_ARB, GLX_CONTEXT_DEBUG_BIT_ARB,
+#endif
+			GLX_CONTEXT_PROFILE_MASK_ARB, SYS_OPENGL_PROFILE,
+			None
+		};
+		__sys_state.gfx_context = __glXCreateContextAttribsARB(__sys_display, config, 0, True, attribs);
+	}
+	if (!__sys_state.gfx_context) {
+		__sys_state.gfx_context = glXCreateNewContext(__sys_display, config, GLX_RGBA_TYPE, 0, True);
+	}
+	sys_assert(__sys_state.gfx_context);
+
+	glXMakeCurrent(__sys_display, (Window)__sys_state.window, (GLXContext)__sys_state.gfx_context);
+
+	glx_swap_interval_ext *__glXSwapIntervalEXT = (glx_swap_interval_ext *)
+		glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalEXT");
+	if (__glXSwapIntervalEXT) {
+		__glXSwapIntervalEXT(__sys_display, (Window)__sys_state.window, 1);
+	}
+#endif /* SYS_OPENGL */
+}
+
+SYS_DEF void *sys_gl_proc(const char *name) {
+#ifdef SYS_OPENGL
+	return (void *)glXGetProcAddressARB((const GLubyte *)name);
+#else
+	sys_unused(name);
+	return 0;
+#endif /* SYS_OPENGL */
+}
+
+static void sys_process_events(void) {
+	while (XPending(__sys_display)) {
+		XEvent event;
+		XNextEvent(__sys_display, &event);
+
+		switch (event.type) {
+			case ClientMessage: {
+				if ((Atom)event.xclient.data.l[0] == __sys_wm_delete_window) {
+					__sys_state.running = 0;
+				}
+			} break;
+			case ConfigureNotify: {
+				__sys_state.width = event.xconfigure.width;
+				__sys_state.height = event.xconfigure.height;
+			} break;
+			case MapNotify: {
+				__sys_state.minimized = 0;
+			} break;
+			case UnmapNotify: {
+				__sys_state.minimized = 1;
+			} break;
+			case FocusIn: {
+				__sys_state.focused = 1;
+			} break;
+			case FocusOut: {
+				memset(__sys_state.keys, 0, sizeof(__sys_state.keys));
+				__sys_state.focused = 0;
+			} break;
+			case MotionNotify: {
+				__sys_state.mouse.dx += event.xmotion.x - __sys_state.mouse.x;
+				__sys_state.mouse.dy += event.xmotion.y - __sys_state.mouse.y;
+				__sys_state.mouse.x = event.xmotion.x;
+				__sys_state.mouse.y = event.xmotion.y;
+			} break;
+			case ButtonPress:
+			case ButtonRelease: {
+				unsigned char down = (unsigned char)(event.type == ButtonPress);
+				switch (event.xbutton.button) {
+					case Button1: { sys_key_set(SYS_MOUSE_LEFT, down); } break;
+					case Button2: { sys_key_set(SYS_MOUSE_MIDDLE, down); } break;
+					case Button3: { sys_key_set(SYS_MOUSE_RIGHT, down); } break;
+					case Button4: { if (down) __sys_state.mouse.dw += 1; } break;
+					case Button5: { if (down) __sys_state.mouse.dw -= 1; } break;
+					case 8: { sys_key_set(SYS_MOUSE_BACKWARD, down); } break;
+					case 9: { sys_key_set(SYS_MOUSE_FORWARD, down); } break;
+				}
+			} break;
+			case KeyPress:
+			case KeyRelease: {
+				unsigned char down = (unsigned char)(event.type == KeyPress);
+				unsigned char key = sys_translate_key(XLookupKeysym(&event.xkey, 0));
+				if (!key) { break; }
+#ifndef SYS_NO_ALT_ENTER
+				if (key == SYS_KEY_ENTER && down) {
+					if (sys_key_down(SYS_KEY_ALT) && !sys_key_down(SYS_KEY_ENTER))
+						sys_toggle_fullscreen();
+				}
+#endif
+				sys_key_set(key, down);
+			} break;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	__sys_display = XOpenDisplay(NULL);
+	if (!__sys_display) {
+		fprintf(stderr, "Error: Failed to open X display.\n");
+		return 1;
+	}
+
+	int screen = DefaultScreen(__sys_display);
+	XSetWindowAttributes attributes = { 0 };
+	unsigned long attribute_mask = CWEventMask | CWBorderPixel;
+	attributes.event_mask = KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask |
+	                        PointerMotionMask | FocusChangeMask | StructureNotifyMask;
+	attributes.border_pixel = 0;
+
+	XVisualInfo *visual = sys_choose_visual();
+	Colormap colormap = 0;
+	if (visual) {
+		colormap = XCreateColormap(__sys_display, RootWindow(__sys_display, screen), visual->visual, AllocNone);
+		attributes.colormap = colormap;
+		attribute_mask |= CWColormap;
+	}
+
+	__sys_state.window = (void *)XCreateWindow(
+		__sys_display, RootWindow(__sys_display, screen),
+		0, 0, 640, 480, 0,
+		visual ? visual->depth : CopyFromParent, InputOutput,
+		visual ? visual->visual : CopyFromParent,
+		attribute_mask, &attributes
+	);
+	if (visual) {
+		XFree(visual);
+	}
+	sys_assert(__sys_state.window);
+
+	__sys_wm_delete_window = XInternAtom(__sys_display, "WM_DELETE_WINDOW", False);
+	XSetWMProtocols(__sys_display, (Window)__sys_state.window, &__sys_wm_delete_window, 1);
+	XkbSetDetectableAutoRepeat(__sys_display, True, NULL);
+
+#ifdef SYS_OPENGL
+	sys_create_gl_context();
+#endif
+
+	Sys_Config cfg;
+#ifdef SYS_INIT_PROC
+	// NOTE: WinMain drops the program name, keep argv the same on both platforms
+	cfg = SYS_INIT_PROC(argc - 1, argv + 1);
+#else
+	cfg = sys_default_config();
+	sys_unused(argc);
+	sys_unused(argv);
+#endif
+	__sys_state.memory = cfg.memory;
+
+	sys_set_title(cfg.title);
+	XMapWindow(__sys_display, (Window)__sys_state.window);
+	sys_set_window_params(cfg.width, cfg.height, cfg.monitor, cfg.fullscreen);
+	__sys_state.running = 1;
+
+	double t1 = 0.0f;
+	double t2 = 0.0f;
+
+	while(__sys_state.running) {
+		t1 = sys_time_now();
+		__sys_state.dt = t1 - t2;
+		__sys_state.mouse.dx = 0;
+		__sys_state.mouse.dy = 0;
+		__sys_state.mouse.dw = 0;
+
+		sys_process_events();
+
+#ifdef SYS_LOOP_PROC
+		SYS_LOOP_PROC(&__sys_state);
+#endif
+		sys_input_advance();
+
+#ifdef SYS_OPENGL
+		glXSwapBuffers(__sys_display, (Window)__sys_state.window);
+#endif
+
+		t2 = t1;
+	}
+
+#ifdef SYS_QUIT_PROC
+	SYS_QUIT_PROC(&__sys_state);
+#else
+	if (__sys_state.memory.ptr) {
+		sys_free(__sys_state.memory);
+	}
+#endif
+
+#ifdef SYS_OPENGL
+	glXMakeCurrent(__sys_display, None, NULL);
+	glXDestroyContext(__sys_display, (GLXContext)__sys_state.gfx_context);
+#endif
+	XDestroyWindow(__sys_display, (Window)__sys_state.window);
+	if (colormap) {
+		XFreeColormap(__sys_display, colormap);
+	}
+	XCloseDisplay(__sys_display);
+
+	return 0;
+}
+#endif /* SYS_HEADLESS */
+
+SYS_DEF void sys_error(const char *message) {
+	sys_message_box("Error", message);
+	sys_quit();
+}
+
+SYS_DEF void sys_quit(void) {
+	__sys_state.running = 0;
+}
+
+#endif /* SYS_LINUX */
+
+//=============================================================================
+//
+//
+//		MEMORY STATS
+//
+//
+//=============================================================================
+static volatile int64_t __sys_memory_used;
+static volatile int64_t __sys_memory_peak;
+
+static void sys_memory_track(int64_t bytes) {
+	int64_t used = sys_atomic64_add(&__sys_memory_used, bytes) + bytes;
+	int64_t peak = __sys_memory_peak;
+	while (used > peak) {
+		sys_atomic64_cas(&__sys_memory_peak, peak, used);
+		peak = __sys_memory_peak;
+	}
+}
+
+SYS_DEF uint64_t sys_memory_used(void) {
+	return (uint64_t)__sys_memory_used;
+}
+
+SYS_DEF uint64_t sys_memory_peak(void) {
+	return (uint64_t)__sys_memory_peak;
+}
+
+SYS_DEF void sys_memory_reset_peak(void) {
+	__sys_memory_peak = __sys_memory_used;
+}
+
+//=============================================================================
+//
+//
+//		JOBS
+//
+//
+//=============================================================================
+#if defined(_MSC_VER)
+	#define SYS_THREAD_LOCAL __declspec(thread)
+#else
+	#define SYS_THREAD_LOCAL __thread
+#endif
+
+typedef struct Sys_Job {
+	sys_job_proc *proc;
+	void *data;
+	int start, end;
+	Sys_Job_Counter *counter;
+} Sys_Job;
+
+// the owner pushes and pops at tail, thieves take from head
+typedef struct Sys_Job_Queue {
+	Sys_Mutex mutex;
+	uint32_t head, tail;
+	Sys_Job jobs[SYS_JOB_QUEUE_SIZE];
+} Sys_Job_Queue;
+
+typedef struct Sys_Job_System {
+	Sys_Memory memory;
+	Sys_Job_Queue *queues; // queue 0 belongs to the thread that called sys_job_init
+	Sys_Thread threads[SYS_MAX_THREADS];
+	int thread_count; // including the calling thread
+	Sys_Semaphore work;
+	volatile int32_t running;
+} Sys_Job_System;
+
+static Sys_Job_System __sys_jobs;
+static SYS_THREAD_LOCAL int __sys_job_thread_index;
+
+static int sys_job_pop(int index, Sys_Job *job) {
+	Sys_Job_Queue *queue = &__sys_jobs.queues[index];
+	int found = 0;
+	sys_mutex_lock(&queue->mutex);
+	if (queue->tail != queue->head) {
+		queue->tail--;
+		*job = queue->jobs[queue->tail & (SYS_JOB_QUEUE_SIZE - 1)];
+		found = 1;
+	}
+	sys_mutex_unlock(&queue->mutex);
+	return found;
+}
+
+static int sys_job_steal(int index, Sys_Job *job) {
+	Sys_Job_Queue *queue = &__sys_jobs.queues[index];
+	int found = 0;
+	if (!sys_mutex_try_lock(&queue->mutex)) {
+		return 0;
+	}
+	if (queue->tail != queue->head) {
+		*job = queue->jobs[queue->head & (SYS_JOB_QUEUE_SIZE - 1)];
+		queue->head++;
+		found = 1;
+	}
+	sys_mutex_unlock(&queue->mutex);
+	return found;
+}
+
+static int sys_job_next(Sys_Job *job) {
+	int self = __sys_job_thread_index;
+	if (sys_job_pop(self, job)) {
+		return 1;
+	}
+	for (int i = 1; i < __sys_jobs.thread_count; i++) {
+		if (sys_job_steal((self + i) % __sys_jobs.thread_count, job)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void sys_job_run(Sys_Job *job) {
+	job->proc(job->data, job->start, job->end);
+	if (job->counter) {
+		sys_memory_barrier();
+		sys_atomic32_dec(&job->counter->value);
+	}
+}
+
+static int sys_job_worker(void *data) {
+	__sys_job_thread_index = (int)(intptr_t)data;
+	for (;;) {
+		sys_semaphore_wait(&__sys_jobs.work);
+		if (!__sys_jobs.running) {
+			break;
+		}
+		Sys_Job job;
+		while (sys_job_next(&job)) {
+			sys_job_run(&job);
+		}
+	}
+	return 0;
+}
+
+SYS_DEF void sys_job_init(int thread_count) {
+	sys_assert(!__sys_jobs.thread_count);
+	if (thread_count <= 0) {
+		thread_count = sys_cpu_count() - 1;
+	}
+	if (thread_count > SYS_MAX_THREADS - 1) {
+		thread_count = SYS_MAX_THREADS - 1;
+	}
+	if (thread_count < 0) {
+		thread_count = 0;
+	}
+
+	__sys_jobs.thread_count = thread_count + 1;
+	__sys_jobs.memory = sys_alloc(sizeof(Sys_Job_Queue) * (size_t)__sys_jobs.thread_count, 0);
+	__sys_jobs.queues = (Sys_Job_Queue *)__sys_jobs.memory.ptr;
+	for (int i = 0; i < __sys_jobs.thread_count; i++) {
+		sys_mutex_init(&__sys_jobs.queues[i].mutex);
+	}
+	sys_semaphore_init(&__sys_jobs.work, 0);
+	__sys_jobs.running = 1;
+	__sys_job_thread_index = 0;
+
+	for (int i = 1; i < __sys_jobs.thread_count; i++) {
+		sys_thread_create(&__sys_jobs.threads[i], sys_job_worker, (void *)(intptr_t)i);
+	}
+}
+
+SYS_DEF void sys_job_shutdown(void) {
+	if (!__sys_jobs.thread_count) {
+		return;
+	}
+	__sys_jobs.running = 0;
+	sys_memory_barrier();
+	for (int i = 1; i < __sys_jobs.thread_count; i++) {
+		sys_semaphore_signal(&__sys_jobs.work);
+	}
+	for (int i = 1; i < __sys_jobs.thread_count; i++) {
+		sys_thread_join(&__sys_jobs.threads[i]);
+	}
+	for (int i = 0; i < __sys_jobs.thread_count; i++) {
+		sys_mutex_destroy(&__sys_jobs.queues[i].mutex);
+	}
+	sys_semaphore_destroy(&__sys_jobs.work);
+	sys_free(__sys_jobs.memory);
+	memset(&__sys_jobs, 0, sizeof(__sys_jobs));
+}
+
+SYS_DEF int sys_job_thread_count(void) {
+	return __sys_jobs.thread_count ? __sys_jobs.thread_count : 1;
+}
+
+SYS_DEF void sys_job_submit(sys_job_proc *proc, void *data, int start, int end, Sys_Job_Counter *counter) {
+	Sys_Job job;
+	job.proc = proc;
+	job.data = data;
+	job.start = start;
+	job.end = end;
+	job.counter = counter;
+	if (counter) {
+		sys_atomic32_inc(&counter->value);
+	}
+
+	// NOTE: without sys_job_init, or with a full queue, the job just runs here
+	if (!__sys_jobs.thread_count) {
+		sys_job_run(&job);
+		return;
+	}
+
+	Sys_Job_Queue *queue = &__sys_jobs.queues[__sys_job_thread_index];
+	int queued = 0;
+	sys_mutex_lock(&queue->mutex);
+	if (queue->tail - queue->head < SYS_JOB_QUEUE_SIZE) {
+		queue->jobs[queue->tail & (SYS_JOB_QUEUE_SIZE - 1)] = job;
+		queue->tail++;
+		queued = 1;
+	}
+	sys_mutex_unlock(&queue->mutex);
+
+	if (!queued) {
+		sys_job_run(&job);
+	} else if (__sys_jobs.thread_count > 1) {
+		sys_semaphore_signal(&__sys_jobs.work);
+	}
+}
+
+SYS_DEF void sys_job_parallel_for(sys_job_proc *proc, void *data, int count, int batch_size, Sys_Job_Counter *counter) {
+	if (batch_size <= 0) {
+		batch_size = count / (sys_job_thread_count() * 4);
+		if (batch_size < 1) {
+			batch_size = 1;
+		}
+	}
+	for (int start = 0; start < count; start += batch_size) {
+		int end = start + batch_size < count ? start + batch_size : count;
+		sys_job_submit(proc, data, start, end, counter);
+	}
+}
+
+SYS_DEF void sys_job_wait(Sys_Job_Counter *counter) {
+	while (counter->value > 0) {
+		Sys_Job job;
+		if (__sys_jobs.thread_count && sys_job_next(&job)) {
+			sys_job_run(&job);
+		} else {
+			sys_sleep(0);
+		}
+	}
+	sys_memory_barrier();
+}
+
+//=============================================================================
+//
+//
+//		TRACE
+//
+//
+//=============================================================================
+#ifndef SYS_TRACE_BUFFER_SIZE
+#define SYS_TRACE_BUFFER_SIZE (64 * 1024) // per thread
+#endif
+#define SYS_TRACE_EVENT_MAX 160 // longest formatted event, names are cut at 64
+
+typedef struct Sys_Trace_Buffer {
+	char *data;
+	uint32_t used;
+	int flushing; // the buffer's own file write isn't traced
+} Sys_Trace_Buffer;
+
+typedef struct Sys_Trace {
+	volatile int32_t running;
+	Sys_File file;
+	volatile int64_t offset; // end of the file, threads reserve their writes here
+	uint64_t start;
+	uint64_t frequency;
+	Sys_Memory memory;
+	Sys_Trace_Buffer buffers[SYS_MAX_THREADS]; // by job thread index
+} Sys_Trace;
+
+static Sys_Trace __sys_trace;
+
+static void sys_trace_flush(Sys_Trace_Buffer *buffer) {
+	if (!buffer->used) {
+		return;
+	}
+	buffer->flushing = 1;
+	int64_t offset = sys_atomic64_add(&__sys_trace.offset, (int64_t)buffer->used);
+	sys_file_write(__sys_trace.file, (uint64_t)offset, buffer->used, buffer->data);
+	buffer->used = 0;
+	buffer->flushing = 0;
+}
+
+static void sys_trace_event(const char *name, char phase) {
+	if (!__sys_trace.running) {
+		return;
+	}
+	Sys_Trace_Buffer *buffer = &__sys_trace.buffers[__sys_job_thread_index];
+	if (buffer->flushing) {
+		return;
+	}
+	if (buffer->used + SYS_TRACE_EVENT_MAX > SYS_TRACE_BUFFER_SIZE) {
+		sys_trace_flush(buffer);
+	}
+
+	double us = (double)(sys_time_ticks() - __sys_trace.start) * 1000000.0 / (double)__sys_trace.frequency;
+	char *out = buffer->data + buffer->used;
+	int length;
+	if (name) {
+		length = snprintf(out, SYS_TRACE_EVENT_MAX, "{\"name\":\"%.64s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n",
+		                  name, phase, us, __sys_job_thread_index);
+	} else {
+		length = snprintf(out, SYS_TRACE_EVENT_MAX, "{\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d},\n",
+		                  phase, us, __sys_job_thread_index);
+	}
+	if (length > 0 && length < SYS_TRACE_EVENT_MAX) {
+		buffer->used += (uint32_t)length;
+	}
+}
+
+SYS_DEF void sys_trace_start(const char *file_name) {
+	if (__sys_trace.running) {
+		sys_trace_stop();
+	}
+	static const char header[] = "{\"traceEvents\":[\n";
+	__sys_trace.file = sys_file_open(file_name);
+	sys_file_set_size(&__sys_trace.file, 0);
+	sys_file_write(__sys_trace.file, 0, sizeof(header) - 1, (void *)header);
+	__sys_trace.offset = sizeof(header) - 1;
+
+	__sys_trace.memory = sys_alloc((size_t)SYS_TRACE_BUFFER_SIZE * SYS_MAX_THREADS, 0);
+	for (int i = 0; i < SYS_MAX_THREADS; i++) {
+		__sys_trace.buffers[i].data = (char *)__sys_trace.memory.ptr + (size_t)i * SYS_TRACE_BUFFER_SIZE;
+		__sys_trace.buffers[i].used = 0;
+		__sys_trace.buffers[i].flushing = 0;
+	}
+	__sys_trace.frequency = sys_time_frequency();
+	__sys_trace.start = sys_time_ticks();
+	sys_memory_barrier();
+	__sys_trace.running = 1;
+}
+
+SYS_DEF void sys_trace_stop(void) {
+	if (!__sys_trace.running) {
+		return;
+	}
+	__sys_trace.running = 0;
+	sys_memory_barrier();
+
+	int threads = sys_job_thread_count();
+	for (int i = 0; i < threads; i++) {
+		sys_trace_flush(&__sys_trace.buffers[i]);
+	}
+
+	// thread names close the array, the last event has no comma after it
+	char *out = __sys_trace.buffers[0].data;
+	uint32_t used = 0;
+	for (int i = 0; i < threads; i++) {
+		int length = snprintf(out + used, SYS_TRACE_EVENT_MAX,
+		                      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}%s\n",
+		                      i, i ? "worker" : "main", i, i + 1 < threads ? "," : "]}");
+		used += (uint32_t)length;
+	}
+	sys_file_write(__sys_trace.file, (uint64_t)__sys_trace.offset, used, out);
+
+	sys_file_close(__sys_trace.file);
+	sys_free(__sys_trace.memory);
+	memset(&__sys_trace, 0, sizeof(__sys_trace));
+}
+
+SYS_DEF void sys_trace_begin(const char *name) {
+	sys_trace_event(name, 'B');
+}
+
+SYS_DEF void sys_trace_end(void) {
+	sys_trace_event(0, 'E');
+}
+
+#ifdef SYS_HEADLESS
+SYS_DEF void sys_message_box(const char *title, const char *message) {
+	fprintf(stderr, "%s: %s\n", title, message);
+}
+
+SYS_DEF void sys_show_cursor(int show) {
+	sys_unused(show);
+}
+
+SYS_DEF void sys_set_title(const char *title) {
+	sys_unused(title);
+}
+
+SYS_DEF void sys_set_window_params(int width, int height, int monitor, int fullscreen) {
+	__sys_state.width = width;
+	__sys_state.height = height;
+	__sys_state.monitor = monitor;
+	__sys_state.fullscreen = fullscreen;
+}
+
+SYS_DEF void sys_toggle_fullscreen(void) {
+}
+
+int main(int argc, char **argv) {
+	Sys_Config cfg;
+#ifdef SYS_INIT_PROC
+	cfg = SYS_INIT_PROC(argc - 1, argv + 1); // same as WinMain, no program name
+#else
+	cfg = sys_default_config();
+	sys_unused(argc);
+	sys_unused(argv);
+#endif
+	__sys_state.memory = cfg.memory;
+
+	sys_set_window_params(cfg.width, cfg.height, cfg.monitor, cfg.fullscreen);
+	__sys_state.focused = 1;
+	__sys_state.running = 1;
+	__sys_state.dt = SYS_HEADLESS_DT;
+
+	while(__sys_state.running) {
+#ifdef SYS_LOOP_PROC
+		SYS_LOOP_PROC(&__sys_state);
+#endif
+		sys_input_advance();
+	}
+
+#ifdef SYS_QUIT_PROC
+	SYS_QUIT_PROC(&__sys_state);
+#else
+	if (__sys_state.memory.ptr) {
+		sys_free(__sys_state.memory);
+	}
+#endif
+	return 0;
+}
+#endif /* SYS_HEADLESS */
+
+#ifndef SYS_INIT_PROC
+// NOTE: only used when the program has no init proc of its own
+static Sys_Config sys_default_config(void) {
+	Sys_Config default_config = { 0 };
+	default_config.width = 1280;
+	default_config.height = 720;
+	default_config.monitor = SYS_MONITOR_PRIMARY;
+	default_config.fullscreen = 0;
+	default_config.title = "What a Wonderful World!";
+	return default_config;
+}
+#endif /* SYS_INIT_PROC */
+
+//=============================================================================
+//
+//
+//  RANDOM
+//
+//
+//=============================================================================
+#define SYS_RAND_MULTIPLIER 6364136223846793005ULL
+
+SYS_DEF void sys_rand_seed(Sys_Rand *rand, uint64_t seed, uint64_t stream) {
+	rand->state = 0;
+	rand->step = (stream << 1) | 1;
+	sys_rand_next(rand);
+	rand->state += seed;
+	sys_rand_next(rand);
+}
+
+SYS_DEF uint32_t sys_rand_next(Sys_Rand *rand) {
+	uint64_t old = rand->state;
+	rand->state = old * SYS_RAND_MULTIPLIER + rand->step;
+	uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+	uint32_t rot = (uint32_t)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+}
+
+// unbiased, rejects the low 2^32 % bound values
+SYS_DEF uint32_t sys_rand_range(Sys_Rand *rand, uint32_t bound) {
+	uint32_t threshold = (0u - bound) % bound;
+	for (;;) {
+		uint32_t r = sys_rand_next(rand);
+		if (r >= threshold) {
+			return r % bound;
+		}
+	}
+}
+
+SYS_DEF float sys_rand_float(Sys_Rand *rand) {
+	return (sys_rand_next(rand) >> 8) * (1.0f / 16777216.0f);
+}
+
+SYS_DEF void sys_rand_advance(Sys_Rand *rand, uint64_t delta) {
+	uint64_t mul = SYS_RAND_MULTIPLIER;
+	uint64_t add = rand->step;
+	uint64_t acc_mul = 1;
+	uint64_t acc_add = 0;
+	while (delta > 0) {
+		if (delta & 1) {
+			acc_mul *= mul;
+			acc_add = acc_add * mul + add;
+		}
+		add = (mul + 1) * add;
+		mul *= mul;
+		delta >>= 1;
+	}
+	rand->state = acc_mul * rand->state + acc_add;
+}
+
+inline unsigned char sys_key_pressed(const unsigned char key) {
+	return (unsigned char)(((__sys_state.keys[key >> 6] & ~__sys_state.prev_keys[key >> 6]) >> (key & 63)) & 1);
+}
+
+inline unsigned char sys_key_released(const unsigned char key) {
+	return (unsigned char)(((~__sys_state.keys[key >> 6] & __sys_state.prev_keys[key >> 6]) >> (key & 63)) & 1);
+}
+
+inline unsigned char sys_key_down(const unsigned char key) {
+	return (unsigned char)((__sys_state.keys[key >> 6] >> (key & 63)) & 1);
+}
+
+inline void sys_key_set(const unsigned char key, int down) {
+	uint64_t bit = (uint64_t)1 << (key & 63);
+	if (down) {
+		__sys_state.keys[key >> 6] |= bit;
+	} else {
+		__sys_state.keys[key >> 6] &= ~bit;
+	}
+}
+
+SYS_DEF int sys_keys_changed(uint64_t changed[SYS_KEY_WORDS]) {
+	uint64_t any = 0;
+	for (int i = 0; i < SYS_KEY_WORDS; i++) {
+		changed[i] = __sys_state.keys[i] ^ __sys_state.prev_keys[i];
+		any |= changed[i];
+	}
+	return any != 0;
+}
+
+static void sys_input_advance(void) {
+	for (int i = 0; i < SYS_KEY_WORDS; i++) {
+		__sys_state.prev_keys[i] = __sys_state.keys[i];
+	}
 }
 
 #endif /* SYS_IMPLEMENTATION */